@@ -7,7 +7,6 @@
 #include <sys/wait.h>
 #include <sys/stat.h>
 #include <iomanip>
-#include <regex>
 #include <string>
 #include <set>
 #include <map>
@@ -25,6 +24,22 @@
 #include <sys/syscall.h>
 #include <math.h>
 #include <unordered_set>
+#include <algorithm>
+#include <new>
+#include <type_traits>
+#include <stdint.h>
+#include <fnmatch.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <poll.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <linux/io_uring.h>
 
 
 using namespace std;
@@ -67,19 +82,38 @@ string _trim(const string &s) {
   return _rtrim(_ltrim(s));
 }
 
-// Command line parsing
-int _parseCommandLine(const char *cmd_line, char **args) {
+// Command line parsing: single pass over the line, tokens are NUL-terminated in place
+void ArgList::parse(const char *line, size_t len) {
   FUNC_ENTRY()
-  int i = 0;
-  istringstream iss(_trim(string(cmd_line)).c_str());
-  for (string s; iss >> s;) {
-    args[i] = (char *)malloc(s.length() + 1);
-    memset(args[i], 0, s.length() + 1);
-    strcpy(args[i], s.c_str());
-    args[++i] = NULL;
+  char *arena = inline_arena;
+  if (len > COMMAND_MAX_LENGTH) {
+    overflow_arena.resize(len + 1);
+    arena = overflow_arena.data();
   }
+  count = 0;
+  bool in_token = false;
+  for (size_t i = 0; i < len; ++i) {
+    char c = line[i];
+    if (c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\f' || c == '\v') {
+      arena[i] = '\0';
+      if (in_token) {
+        views[count - 1] = ArgView(argv_ptrs[count - 1], arena + i - argv_ptrs[count - 1]);
+        in_token = false;
+      }
+      continue;
+    }
+    arena[i] = c;
+    if (!in_token && count < COMMAND_MAX_ARGS) {
+      argv_ptrs[count++] = arena + i;
+      in_token = true;
+    }
+  }
+  arena[len] = '\0';
+  if (in_token) {
+    views[count - 1] = ArgView(argv_ptrs[count - 1], arena + len - argv_ptrs[count - 1]);
+  }
+  argv_ptrs[count] = nullptr;
   FUNC_EXIT()
-  return i;
 }
 
 // Background command utilities
@@ -116,35 +150,162 @@ SmallShell::SmallShell()
     is_foreground_running(false), 
     prompt("smash"), 
     lastWorkingDir(""), 
-    prevWorkingDir("") 
-{}
+    prevWorkingDir(""),
+    commandCache(COMMAND_CACHE_SIZE)
+{
+  // A reap that frees a slot starts the next queued line right away
+  jobs.setSlotFreedHandler([]() { SmallShell::getInstance().startQueuedJobs(); });
+}
+
+/*******************************************************
+ *               BUILT-IN COMMAND REGISTRY             *
+ *******************************************************/
+
+// FNV-1a hash, evaluated at compile time for the registry case labels below.
+// Two builtin names hashing to the same value would be a duplicate case label,
+// so the registry is guaranteed to be a perfect hash by the compiler.
+constexpr unsigned _fnv1a(const char *s, unsigned h = 2166136261u) {
+  return *s ? _fnv1a(s + 1, (h ^ static_cast<unsigned char>(*s)) * 16777619u) : h;
+}
+
+// Constructor argument policies: which shell state a command class is built with
+struct _PlainCtor {
+  template <class T>
+  static T *construct(void *where, const char *cmd_line, SmallShell &) {
+    return new (where) T(cmd_line);
+  }
+};
+
+struct _JobsCtor {
+  template <class T>
+  static T *construct(void *where, const char *cmd_line, SmallShell &smash) {
+    return new (where) T(cmd_line, smash.getJobsList());
+  }
+};
+
+struct _AliasCtor {
+  template <class T>
+  static T *construct(void *where, const char *cmd_line, SmallShell &smash) {
+    return new (where) T(cmd_line, smash.getAliasMap());
+  }
+};
+
+// Heap construction, for callers that need a Command* (e.g. pipeline stages)
+template <class T, class Ctor>
+Command *_createCommand(const char *cmd_line, SmallShell &smash) {
+  return Ctor::template construct<T>(::operator new(sizeof(T)), cmd_line, smash);
+}
+
+// In-place construction on the stack with a statically dispatched execute()
+template <class T, class Ctor>
+void _runCommand(const char *cmd_line, const char *raw_cmd_line, SmallShell &smash) {
+  typename aligned_storage<sizeof(T), alignof(T)>::type storage;
+  T *cmd = Ctor::template construct<T>(&storage, cmd_line, smash);
+  cmd->setUneditedCmdLine(raw_cmd_line);
+  cmd->T::execute();
+  cmd->~T();
+}
+
+template <class T, class Ctor>
+const CommandOps *_commandOps() {
+  static const CommandOps ops = {&_createCommand<T, Ctor>, &_runCommand<T, Ctor>};
+  return &ops;
+}
+
+#define BUILTIN(name, T, Ctor) \
+  case _fnv1a(name): return strcmp(word, name) == 0 ? _commandOps<T, Ctor>() : nullptr;
 
 /**
- * @brief Creates and returns the appropriate Command object based on the given command line input.
+ * @brief Looks up the operations of a built-in command by its name.
+ * 
+ * @param word The first word of the command line.
+ * @return The operations that instantiate the command, or nullptr if word is not a built-in.
+ */
+static const CommandOps *_lookupBuiltin(const char *word) {
+  switch (_fnv1a(word)) {
+    BUILTIN("chprompt", ChPromptCommand, _PlainCtor)
+    BUILTIN("showpid", ShowPidCommand, _PlainCtor)
+    BUILTIN("pwd", GetCurrDirCommand, _PlainCtor)
+    BUILTIN("cd", ChangeDirCommand, _PlainCtor)
+    BUILTIN("jobs", JobsCommand, _JobsCtor)
+    BUILTIN("alias", AliasCommand, _AliasCtor)
+    BUILTIN("unalias", UnAliasCommand, _AliasCtor)
+    BUILTIN("kill", KillCommand, _JobsCtor)
+    BUILTIN("quit", QuitCommand, _JobsCtor)
+    BUILTIN("fg", ForegroundCommand, _JobsCtor)
+    BUILTIN("bg", BackgroundCommand, _JobsCtor)
+    BUILTIN("stop", StopCommand, _JobsCtor)
+    BUILTIN("unsetenv", UnSetEnvCommand, _PlainCtor)
+    BUILTIN("watchproc", WatchProcCommand, _PlainCtor)
+    BUILTIN("du", DiskUsageCommand, _PlainCtor)
+    BUILTIN("whoami", WhoAmICommand, _PlainCtor)
+    BUILTIN("cachestats", CacheStatsCommand, _PlainCtor)
+    BUILTIN("wait", WaitCommand, _JobsCtor)
+    BUILTIN("jobslots", JobSlotsCommand, _JobsCtor)
+    BUILTIN("run", RunCommand, _JobsCtor)
+    BUILTIN("hash", HashCommand, _PlainCtor)
+    default:
+      return nullptr;
+  }
+}
+
+#undef BUILTIN
+
+// Alias names are made of [a-zA-Z0-9_]+
+static bool _isAliasName(const string &name) {
+  if (name.empty()) {
+    return false;
+  }
+  for (char c : name) {
+    if (!isalnum(static_cast<unsigned char>(c)) && c != '_') {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Matches a full alias definition: alias <name>='<command>' (no quotes inside <command>)
+static bool _isAliasDefinition(const string &cmd_s) {
+  static const char prefix[] = "alias ";
+  const size_t prefix_len = sizeof(prefix) - 1;
+  if (cmd_s.compare(0, prefix_len, prefix) != 0) {
+    return false;
+  }
+  size_t equal_pos = cmd_s.find('=', prefix_len);
+  if (equal_pos == string::npos || !_isAliasName(cmd_s.substr(prefix_len, equal_pos - prefix_len))) {
+    return false;
+  }
+  size_t quote_pos = equal_pos + 1;
+  return cmd_s.size() >= quote_pos + 2 && cmd_s[quote_pos] == '\'' &&
+         cmd_s.find('\'', quote_pos + 1) == cmd_s.size() - 1;
+}
+
+/**
+ * @brief Parses a raw command line into the factory and expanded line that build its Command.
  * 
- * This function parses the command line, checks for aliases, and determines the type of command
- * (e.g., built-in, redirection, pipe, external). It then constructs and returns the corresponding
- * Command object.
+ * This function trims the command line, expands aliases and determines the type of command
+ * (e.g., built-in, redirection, pipe, external). Built-in commands are resolved through the
+ * registry in _lookupBuiltin. The result only depends on the line and the alias map, which
+ * is what allows CreateCommand to cache it.
  * 
- * @param cmd_line_cstr The raw command line input as a C-string.
- * @return A pointer to the created Command object.
+ * @param cmd_s_unedited The raw command line input.
+ * @return The operations that instantiate the command and the line to build it from.
  */
-Command *SmallShell::CreateCommand(const char *cmd_line_cstr) {
-  string cmd_s_unedited = string(cmd_line_cstr);
-  string cmd_s = _trim(string(cmd_line_cstr));
-  regex alias_definition_regex("^alias [a-zA-Z0-9_]+='[^']*'$");
+CommandCache::ParsedLine SmallShell::parseCommandLine(const string &cmd_s_unedited) {
+  string cmd_s = _trim(cmd_s_unedited);
 
   // 1. Check if the entire command is an alias definition
-  if (regex_match(cmd_s, alias_definition_regex)) {
-    return new AliasCommand(cmd_s.c_str(), aliasMap);
+  if (_isAliasDefinition(cmd_s)) {
+    return CommandCache::ParsedLine{_commandOps<AliasCommand, _AliasCtor>(), cmd_s};
   }
 
-  // 2. Attempt alias expansion (one level)
+  // 2. Attempt alias expansion. aliasExpansions already holds the result of
+  // following the whole alias chain, so this is a single lookup.
   // Extract the first word for potential expansion
   string first_word_for_expansion = cmd_s.substr(0, cmd_s.find_first_of(WHITESPACE));
-  auto aliasIt = aliasMap.find(first_word_for_expansion);
+  auto aliasIt = aliasExpansions.find(first_word_for_expansion);
 
-  if (aliasIt != aliasMap.end()) { // first_word_for_expansion is an alias
+  if (aliasIt != aliasExpansions.end()) { // first_word_for_expansion is an alias
     string base_alias_command = aliasIt->second;
     string remaining_args_str;
     size_t first_word_len = first_word_for_expansion.length();
@@ -164,90 +325,323 @@ Command *SmallShell::CreateCommand(const char *cmd_line_cstr) {
   // 3. Proceed with parsing the (potentially expanded) command string cmd_s
   string firstWord = cmd_s.substr(0, cmd_s.find_first_of(WHITESPACE));
 
+  // Handle fan-out pipelines. Checked before redirection, since |> contains >.
+  if (cmd_s.find("|>") != string::npos) {
+    _removeBackgroundSign(&cmd_s[0]); // Remove background sign if present
+    return CommandCache::ParsedLine{_commandOps<FanOutCommand, _PlainCtor>(), cmd_s.c_str()};
+  }
   // Handle redirection commands
-  if (cmd_s.find(">") != string::npos || cmd_s.find(">>") != string::npos) {
+  else if (cmd_s.find(">") != string::npos || cmd_s.find(">>") != string::npos) {
     _removeBackgroundSign(&cmd_s[0]); // Remove background sign if present
-    return new RedirectionCommand(cmd_s.c_str());
+    return CommandCache::ParsedLine{_commandOps<RedirectionCommand, _PlainCtor>(), cmd_s.c_str()};
   }
   // Handle pipe commands
   else if (cmd_s.find("|") != string::npos || cmd_s.find("|&") != string::npos) {
     _removeBackgroundSign(&cmd_s[0]); // Remove background sign if present
-    return new PipeCommand(cmd_s.c_str());
+    return CommandCache::ParsedLine{_commandOps<PipeCommand, _PlainCtor>(), cmd_s.c_str()};
   }
-  // Handle built-in commands
-  else if (firstWord == "chprompt") {
-    _removeBackgroundSign(&cmd_s[0]); // Remove background sign if present
-    return new ChPromptCommand(cmd_s.c_str());
-  } else if (firstWord == "showpid") {
-    _removeBackgroundSign(&cmd_s[0]); // Remove background sign if present
-    return new ShowPidCommand(cmd_s.c_str());
-  } else if (firstWord == "pwd") {
-    _removeBackgroundSign(&cmd_s[0]); // Remove background sign if present
-    return new GetCurrDirCommand(cmd_s.c_str());
-  } else if (firstWord == "cd") {
-    _removeBackgroundSign(&cmd_s[0]); // Remove background sign if present
-    return new ChangeDirCommand(cmd_s.c_str());
-  } else if (firstWord == "jobs") {
-    _removeBackgroundSign(&cmd_s[0]); // Remove background sign if present
-    return new JobsCommand(cmd_s.c_str(), jobs);
-  } else if (firstWord == "alias") {
-    // This handles "alias" (to list aliases) or invalid alias definitions
-    // that were not caught by the regex, e.g., "alias name" or "alias name="
-    _removeBackgroundSign(&cmd_s[0]); // Remove background sign if present
-    return new AliasCommand(cmd_s.c_str(), aliasMap);
-  } else if (firstWord == "unalias") {
-    _removeBackgroundSign(&cmd_s[0]); // Remove background sign if present
-    return new UnAliasCommand(cmd_s.c_str(), aliasMap);
-  } else if (firstWord == "kill") {
-    _removeBackgroundSign(&cmd_s[0]); // Remove background sign if present
-    return new KillCommand(cmd_s.c_str(), jobs);
-  } else if (firstWord == "quit") {
-    _removeBackgroundSign(&cmd_s[0]); // Remove background sign if present
-    return new QuitCommand(cmd_s.c_str(), jobs);
-  } else if (firstWord == "fg") {
-    _removeBackgroundSign(&cmd_s[0]); // Remove background sign if present
-    return new ForegroundCommand(cmd_s.c_str(), jobs);
-  } else if (firstWord == "unsetenv") {
-    _removeBackgroundSign(&cmd_s[0]); // Remove background sign if present
-    return new UnSetEnvCommand(cmd_s.c_str());
-  } else if (firstWord == "watchproc") {
-    _removeBackgroundSign(&cmd_s[0]); // Remove background sign if present
-    return new WatchProcCommand(cmd_s.c_str());
-  } else if (firstWord == "du")  {
-    _removeBackgroundSign(&cmd_s[0]); // Remove background sign if present
-    return new DiskUsageCommand(cmd_s.c_str());
-  } else if (firstWord == "whoami") {
-    _removeBackgroundSign(&cmd_s[0]); // Remove background sign if present
-    return new WhoAmICommand(cmd_s.c_str());
+  // Handle built-in commands. run launches an external command, so it keeps the background sign.
+  const CommandOps *builtin = _lookupBuiltin(firstWord.c_str());
+  if (builtin != nullptr) {
+    if (builtin != _commandOps<RunCommand, _JobsCtor>()) {
+      _removeBackgroundSign(&cmd_s[0]); // Remove background sign if present
+    }
+    return CommandCache::ParsedLine{builtin, cmd_s.c_str()};
   }
-  // Handle external commands
-  else {
-    if (cmd_s.find('?') != string::npos || cmd_s.find('*') != string::npos) {
-      return new ComplexExternalCommand(cmd_s_unedited.c_str(), jobs);
-    } else {
-      return new SimpleExternalCommand(cmd_s_unedited.c_str(), jobs);
+  // Handle external commands. Plain wildcards are expanded by smash; any other
+  // shell syntax (quotes, variables, ~, ;, ...) still goes to bash.
+  if (cmd_s.find('?') != string::npos || cmd_s.find('*') != string::npos) {
+    size_t ampersand = cmd_s.find('&');
+    if (cmd_s.find_first_of("'\"`$\\;(){}~<#") == string::npos &&
+        (ampersand == string::npos || ampersand == cmd_s.size() - 1)) {
+      return CommandCache::ParsedLine{_commandOps<GlobExternalCommand, _JobsCtor>(), cmd_s};
     }
+    return CommandCache::ParsedLine{_commandOps<ComplexExternalCommand, _JobsCtor>(), cmd_s};
+  } else {
+    return CommandCache::ParsedLine{_commandOps<SimpleExternalCommand, _JobsCtor>(), cmd_s};
+  }
+}
+
+/**
+ * @brief Resolves a raw command line through the command cache.
+ * 
+ * The key is copied into the lookupKey member, whose capacity is kept between
+ * calls, so a hit does not allocate once a line of that length has been seen.
+ * On a miss the line is parsed by parseCommandLine and the result is cached,
+ * which does allocate.
+ * 
+ * @param cmd_line The raw command line input.
+ * @param fresh Storage for the parsed line on a miss.
+ * @return The parsed line; valid until the cache is next modified.
+ */
+const CommandCache::ParsedLine *SmallShell::lookupCommandLine(const char *cmd_line, CommandCache::ParsedLine &fresh) {
+  lookupKey.assign(cmd_line);
+  const CommandCache::ParsedLine *parsed = commandCache.find(lookupKey);
+  if (parsed == nullptr) {
+    fresh = parseCommandLine(lookupKey);
+    commandCache.insert(lookupKey, fresh);
+    parsed = &fresh;
   }
+  return parsed;
+}
+
+/**
+ * @brief Creates and returns the appropriate Command object based on the given command line input.
+ * 
+ * External commands are built from the alias-expanded line but keep the raw line
+ * for the jobs list. The caller owns the returned object.
+ * 
+ * @param cmd_line_cstr The raw command line input as a C-string.
+ * @return A pointer to the created Command object.
+ */
+Command *SmallShell::CreateCommand(const char *cmd_line_cstr) {
+  CommandCache::ParsedLine fresh;
+  const CommandCache::ParsedLine *parsed = lookupCommandLine(cmd_line_cstr, fresh);
+
+  Command *cmd = parsed->ops->create(parsed->cmd_line.c_str(), *this);
+  cmd->setUneditedCmdLine(cmd_line_cstr);
+  return cmd;
 }
 
 /**
- * @brief Executes a command by creating and running the appropriate Command object.
+ * @brief Executes a command line.
  * 
- * This function parses the given command line, creates the corresponding Command object,
- * executes it, and then cleans up the allocated memory for the command.
+ * The command object is constructed in place on the stack and its execute() is
+ * dispatched statically, so running a built-in does not heap-allocate the Command
+ * object itself. Its constructor still copies and splits the line, and a command
+ * cache miss parses and stores the line (see lookupCommandLine).
  * 
  * @param cmd_line The command line input as a C-string.
  * @return None.
  */
 void SmallShell::executeCommand(const char *cmd_line) {
-  // Create the appropriate Command object based on the command line input
-  Command *cmd = CreateCommand(cmd_line);
+  // Collect jobs that exited since the last command (cheap unless SIGCHLD arrived)
+  // and hand their slots to queued background commands
+  jobs.removeFinishedJobs();
+  jobs.clearUnclaimed(); // No foreground command is running
+  startQueuedJobs();
 
-  // Execute the command
-  cmd->execute();
+  // Nothing to do for an empty line
+  if (cmd_line[strspn(cmd_line, WHITESPACE.c_str())] == '\0') {
+    return;
+  }
 
-  // Clean up the allocated Command object
-  delete cmd;
+  CommandCache::ParsedLine fresh;
+  const CommandCache::ParsedLine *parsed = lookupCommandLine(cmd_line, fresh);
+
+  // The command copies the expanded line when constructed, so it stays valid
+  // even if execute() invalidates the cache (e.g. alias/unalias).
+  parsed->ops->run(parsed->cmd_line.c_str(), cmd_line, *this);
+}
+
+/**
+ * @brief Starts queued background commands while job slots are free.
+ * 
+ * A queued line is resolved again when it starts and launched directly, so it
+ * does not go back to the end of the queue. Launching reaps jobs, which may call
+ * back into this function; the outer call keeps starting lines instead.
+ * 
+ * @return The job IDs of the started jobs.
+ */
+vector<int> SmallShell::startQueuedJobs() {
+  static bool starting = false;
+  vector<int> started;
+  if (starting) {
+    return started;
+  }
+  starting = true;
+  string line;
+  while (jobs.hasQueuedJobs() && jobs.hasFreeSlot() && jobs.popQueuedJob(line)) {
+    Command *cmd = CreateCommand(line.c_str());
+    ExternalCommand *external = dynamic_cast<ExternalCommand *>(cmd);
+    size_t before = jobs.size();
+    if (external != nullptr) {
+      external->launch();
+    } else {
+      cmd->execute(); // The line no longer names an external command (e.g. alias changed)
+    }
+    if (jobs.size() > before) {
+      started.push_back(jobs.getLargestJobId());
+    }
+    delete cmd;
+  }
+  starting = false;
+  return started;
+}
+
+/**
+ * @brief Waits for a foreground child to exit or stop.
+ * 
+ * Instead of blocking in waitpid, the shell sleeps on the SIGCHLD pipe, so a
+ * background job that exits meanwhile is reaped and its slot handed to the next
+ * queued line at once. If that reap collects the foreground child itself, its
+ * status is taken from the jobs list.
+ * 
+ * @param pid The foreground child.
+ * @param status Receives the wait status.
+ * @return pid, or -1 with errno set on failure.
+ */
+pid_t SmallShell::waitForeground(pid_t pid, int *status) {
+  int event_fd = getChildEventFd();
+  while (true) {
+    drainChildEventFd();
+    pid_t result = waitpid(pid, status, event_fd == -1 ? WUNTRACED : WNOHANG | WUNTRACED);
+    if (result != 0 && !(result == -1 && errno == EINTR)) {
+      return result;
+    }
+    jobs.removeFinishedJobs();
+    if (jobs.claimStatus(pid, *status)) {
+      return pid;
+    }
+    struct pollfd pfd = {event_fd, POLLIN, 0};
+    poll(&pfd, 1, -1); // EINTR (e.g. ctrl-Z) just checks again
+  }
+}
+
+/**
+ * @brief Blocks until fd is readable, reaping background jobs meanwhile.
+ * 
+ * Used while the prompt is idle, so that a freed slot starts the next queued
+ * line without waiting for the user to type a command, and so that the du
+ * index keeps up with its inotify queue instead of letting it overflow.
+ * 
+ * @param fd The fd to wait for (the shell's input).
+ * @return None.
+ */
+void SmallShell::waitForInput(int fd) {
+  int event_fd = getChildEventFd();
+  while (event_fd != -1) {
+    // poll ignores a negative fd, i.e. when no du index is being kept
+    struct pollfd pfds[3] = {{fd, POLLIN, 0}, {event_fd, POLLIN, 0}, {duIndex.getFd(), POLLIN, 0}};
+    if (poll(pfds, 3, -1) == -1 && errno != EINTR) {
+      return;
+    }
+    if (pfds[1].revents & POLLIN) {
+      drainChildEventFd();
+      jobs.removeFinishedJobs();
+    }
+    if (pfds[2].revents & POLLIN) {
+      duIndex.applyPendingEvents();
+    }
+    if (pfds[0].revents != 0) {
+      return;
+    }
+  }
+}
+
+/**
+ * @brief Splits a new PATH value into directories and drops every entry.
+ * 
+ * @param path The PATH value, or nullptr if PATH is unset.
+ * @return None.
+ */
+void PathCache::reset(const char *path) {
+  initialized = true;
+  // As in execvp, an unset PATH means the confstr default
+  pathValue = path ? path : "/bin:/usr/bin";
+  entries.clear();
+  dirs.clear();
+  size_t start = 0;
+  while (true) {
+    size_t colon = pathValue.find(':', start);
+    Dir dir;
+    dir.path = pathValue.substr(start, colon == string::npos ? string::npos : colon - start);
+    dir.statted = false;
+    dirs.push_back(dir);
+    if (colon == string::npos) {
+      break;
+    }
+    start = colon + 1;
+  }
+}
+
+// Records the current mtime of a PATH directory (zero if it cannot be stat'ed)
+void PathCache::statDir(Dir &dir) {
+  clock_gettime(CLOCK_MONOTONIC, &dir.checked);
+  struct stat st;
+  if (stat(dir.path.empty() ? "." : dir.path.c_str(), &st) == 0) {
+    dir.mtime = st.st_mtim;
+  } else {
+    dir.mtime.tv_sec = 0;
+    dir.mtime.tv_nsec = 0;
+  }
+  dir.statted = true;
+}
+
+/**
+ * @brief Checks that a cached entry's directory is unmodified.
+ * 
+ * The directory is stat'ed again only if it was last checked more than a second ago.
+ * 
+ * @param dirIndex The index of the directory.
+ * @return True if its mtime did not change since it was searched.
+ */
+bool PathCache::dirUnchanged(size_t dirIndex) {
+  Dir &dir = dirs[dirIndex];
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (now.tv_sec - dir.checked.tv_sec < 1 ||
+      (now.tv_sec - dir.checked.tv_sec == 1 && now.tv_nsec < dir.checked.tv_nsec)) {
+    return true;
+  }
+  struct timespec recorded = dir.mtime;
+  statDir(dir);
+  return recorded.tv_sec == dir.mtime.tv_sec && recorded.tv_nsec == dir.mtime.tv_nsec;
+}
+
+/**
+ * @brief Resolves a command name to an executable through PATH, using the cache when valid.
+ * 
+ * A hit is revalidated against its own directory only (see PathCache), so an
+ * executable later added to an earlier PATH directory needs `hash -r`.
+ * 
+ * @param name The command name (argv[0]).
+ * @return The absolute path of the executable, or nullptr if the name contains a '/'
+ *         or no PATH directory has it. Valid until the next call.
+ */
+const string *PathCache::resolve(const string &name) {
+  if (name.empty() || name.find('/') != string::npos) {
+    return nullptr;
+  }
+  const char *path = getenv("PATH");
+  if (!initialized || pathValue != (path ? path : "/bin:/usr/bin")) {
+    reset(path);
+  }
+
+  auto it = entries.find(name);
+  if (it != entries.end()) {
+    size_t dirIndex = it->second.dirIndex;
+    if (dirUnchanged(dirIndex)) {
+      ++it->second.hits;
+      return &it->second.path;
+    }
+    // Something was added to or removed from that directory: forget what was found there
+    for (auto entry = entries.begin(); entry != entries.end();) {
+      entry = (entry->second.dirIndex == dirIndex) ? entries.erase(entry) : next(entry);
+    }
+  }
+
+  for (size_t i = 0; i < dirs.size(); ++i) {
+    if (!dirs[i].statted) {
+      statDir(dirs[i]);
+    }
+    string candidate = (dirs[i].path.empty() ? "." : dirs[i].path) + "/" + name;
+    struct stat st;
+    if (stat(candidate.c_str(), &st) != 0 || !S_ISREG(st.st_mode) || access(candidate.c_str(), X_OK) != 0) {
+      continue;
+    }
+    if (dirs[i].path.empty() || dirs[i].path[0] != '/') {
+      // Relative to the working directory, which cd changes
+      uncached = candidate;
+      return &uncached;
+    }
+    Entry &entry = entries[name];
+    entry.path = candidate;
+    entry.dirIndex = i;
+    entry.hits = 1;
+    return &entry.path;
+  }
+  return nullptr;
 }
 
 /**
@@ -258,21 +652,22 @@ void SmallShell::executeCommand(const char *cmd_line) {
  * 
  * @param cmd_line_input The raw command line input as a C-string.
  */
-Command::Command(const char *cmd_line_input)
-  : cmd_line(_trim(string(cmd_line_input))), cmd_line_unedited(string(cmd_line_input)), is_background(false), alias("") {
-  
-  // Determine if the command is a background command
-  is_background = _isBackgroundComamnd(cmd_line.c_str());
+Command::Command(const char *cmd_line_input) : is_background(false) {
+  // Store the raw and the trimmed command line in the command's own buffers
+  size_t raw_len = strlen(cmd_line_input);
+  cmd_line_unedited.assign(cmd_line_input, raw_len);
+  size_t start = strspn(cmd_line_input, WHITESPACE.c_str());
+  size_t end = raw_len;
+  while (end > start && strchr(WHITESPACE.c_str(), cmd_line_input[end - 1]) != nullptr) {
+    --end;
+  }
+  cmd_line.assign(cmd_line_input + start, end - start);
 
-  // Parse the command line into arguments
-  char *raw_args[COMMAND_MAX_ARGS + 1];
-  int argsCount = _parseCommandLine(this->cmd_line.c_str(), raw_args);
+  // Determine if the command is a background command
+  is_background = !cmd_line.empty() && cmd_line[cmd_line.size() - 1] == '&';
 
-  // Store the parsed arguments in the args vector
-  for (int i = 0; i < argsCount; ++i) {
-  args.push_back(string(raw_args[i]));
-    free(raw_args[i]); // Free the allocated memory for each argument
-  }
+  // Tokenize the command line (without the background sign) into the args arena
+  args.parse(cmd_line.c_str(), is_background ? cmd_line.size() - 1 : cmd_line.size());
 }
 
 
@@ -391,26 +786,136 @@ void ChangeDirCommand::execute() {
   free(currentDir);
 }
 
+// Seconds elapsed since a CLOCK_MONOTONIC timestamp
+static double _secondsSince(const struct timespec &start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+// The current CLOCK_MONOTONIC time, for exits observed directly (fg, wait)
+static struct timespec _monotonicNow() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now;
+}
+
+static double _timevalSeconds(const struct timeval &tv) {
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/**
+ * @brief Moves a reaped job from the jobs list into the finished-jobs history.
+ * 
+ * The history keeps the last JOBS_HISTORY_SIZE jobs, oldest dropped first.
+ * 
+ * @param jobId The ID of the reaped job.
+ * @param status The wait status returned by wait4.
+ * @param usage The resource usage returned by wait4.
+ * @param end When the exit was observed (CLOCK_MONOTONIC); the elapsed time ends there.
+ * @return None.
+ */
+void JobsList::finishJob(int jobId, int status, const struct rusage &usage, const struct timespec &end) {
+  JobEntry *job = getJobById(jobId);
+  if (job == nullptr) {
+    return;
+  }
+  FinishedJob record;
+  record.jobId = jobId;
+  record.pid = job->getPid();
+  record.cmdLine = job->getCmdLine();
+  record.status = status;
+  const struct timespec &start = job->getStartTime();
+  record.elapsedSeconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  record.usage = usage;
+  if (history.size() == JOBS_HISTORY_SIZE) {
+    history.pop_front();
+  }
+  history.push_back(record);
+  removeJobById(jobId);
+}
+
+/**
+ * @brief Prints every job with its PID, state and time since it was started.
+ * 
+ * @param None.
+ * @return None (outputs to the standard output).
+ */
+void JobsList::printJobsListLong() const {
+  ios::fmtflags flags = cout.flags();
+  for (size_t word = 0; word < occupied.size(); ++word) {
+    for (uint64_t bits = occupied[word]; bits != 0; bits &= bits - 1) {
+      const JobEntry &job = slots[word * 64 + __builtin_ctzll(bits)];
+      cout << "[" << job.getJobId() << "] " << job.getCmdLine() << " : pid " << job.getPid()
+           << (job.isStopped() ? ", Stopped, " : ", Running, ") << fixed << setprecision(2) << _secondsSince(job.getStartTime()) << "s";
+      if (!job.getPolicy().empty()) {
+        cout << ", " << job.getPolicy();
+      }
+      cout << endl;
+    }
+  }
+  for (const string &cmdLine : queued) {
+    cout << "[queued] " << cmdLine << " : Queued" << endl;
+  }
+  cout.flags(flags);
+}
+
+/**
+ * @brief Prints the exit status and resource usage of recently finished jobs.
+ * 
+ * @param None.
+ * @return None (outputs to the standard output).
+ */
+void JobsList::printHistory() const {
+  ios::fmtflags flags = cout.flags();
+  for (const FinishedJob &job : history) {
+    cout << "[" << job.jobId << "] " << job.cmdLine << " : pid " << job.pid << ", ";
+    if (WIFSIGNALED(job.status)) {
+      cout << "signal " << WTERMSIG(job.status);
+    } else {
+      cout << "exit " << WEXITSTATUS(job.status);
+    }
+    cout << fixed << setprecision(2)
+         << ", real " << job.elapsedSeconds << "s"
+         << ", user " << _timevalSeconds(job.usage.ru_utime) << "s"
+         << ", sys " << _timevalSeconds(job.usage.ru_stime) << "s"
+         << ", maxrss " << job.usage.ru_maxrss << " KB"
+         << ", majflt " << job.usage.ru_majflt
+         << ", ctxsw " << job.usage.ru_nvcsw << "/" << job.usage.ru_nivcsw << endl;
+  }
+  cout.flags(flags);
+}
+
 /**
  * @brief Executes the JobsCommand to display the list of active jobs.
  * 
  * This function removes any finished jobs from the jobs list and then
  * prints the remaining active jobs to the standard output.
+ * `jobs -l` adds the PID, state and elapsed time of each job, and
+ * `jobs --done` prints the exit status and resource usage of recently
+ * finished jobs instead.
  * 
  * @param None (uses the jobs list stored in the `jobs` member).
  * @return None (outputs the jobs list to the standard output).
  */
 void JobsCommand::execute() {
   jobs.removeFinishedJobs();
-  jobs.printJobsList();
+  if (args.size() > 1 && args[1] == "-l") {
+    jobs.printJobsListLong();
+  } else if (args.size() > 1 && args[1] == "--done") {
+    jobs.printHistory();
+  } else {
+    jobs.printJobsList();
+  }
 }
 
 /**
  * @brief Executes the ForegroundCommand to bring a job to the foreground.
  * 
  * This function validates the input arguments, retrieves the specified job,
- * and waits for its process to finish. It also updates the shell's foreground
- * process state and handles errors appropriately.
+ * continues it if it is stopped, and waits for its process to finish. If the
+ * job is stopped again (ctrl-Z), it stays in the jobs list as stopped. It also
+ * updates the shell's foreground process state and handles errors appropriately.
  * 
  * @param None (uses the command-line arguments stored in the `args` member).
  * @return None (outputs error messages to standard error if applicable).
@@ -461,110 +966,462 @@ void ForegroundCommand::execute() {
   SmallShell &smash = SmallShell::getInstance();
   smash.setForegroundPid(job->getPid());
 
+  if (job->isStopped()) {
+    if (job->sendGroupSignal(SIGCONT) == -1) {
+      perror("smash error: kill failed");
+      smash.clearForegroundPid();
+      return;
+    }
+    jobs.setJobStopped(job, false);
+  }
+
   // Wait for the job's process to finish
   int status;
-  if (waitpid(job->getPid(), &status, WUNTRACED) == -1) {
+  struct rusage usage;
+  if (wait4(job->getPid(), &status, WUNTRACED, &usage) == -1) {
     perror("smash error: waitpid failed");
     smash.clearForegroundPid(); // Clear foreground PID as waiting failed
     return;
   }
 
   if (WIFEXITED(status) || WIFSIGNALED(status)) {
-    jobs.removeJobById(job->getJobId());
+    jobs.finishJob(job->getJobId(), status, usage, _monotonicNow());
     smash.clearForegroundPid();
   } else if (WIFSTOPPED(status)) {
+    jobs.setJobStopped(job, true);
     smash.clearForegroundPid();
   }
   return;
 }
 
 /**
- * @brief Executes the QuitCommand to terminate the shell.
- * 
- * This function checks if the "kill" argument is provided. If so, it sends a SIGKILL signal
- * to all remaining jobs in the jobs list, prints their details, and clears the jobs list.
- * Finally, it exits the shell process.
+ * @brief Parses the optional job-id argument of `stop` and `bg`.
  * 
- * @param None (uses the command-line arguments stored in the `args` member).
- * @return None (terminates the shell process).
+ * @param args The command's arguments.
+ * @param name The command's name, used in error messages.
+ * @param jobId Set to the parsed job ID, or 0 if no job ID was given.
+ * @return True if the arguments are valid, false otherwise (after printing an error).
  */
-void QuitCommand::execute() {
-  // Check if the "kill" argument is provided
-  // As per PDF: "You may assume that the kill argument, if present, will appear first."
-  // "If any number of arguments (other than kill) were provided with this command, they will be ignored."
-  // This means we only care if args[1] is "kill".
-  bool killFlag = (args.size() > 1 && args[1] == "kill");
-
-  if (killFlag) {
-    // As per teacher's note, ensure finished jobs are removed before counting/killing.
-    jobs.removeFinishedJobs(); 
-
-    // Get the list of remaining jobs
-    vector<JobsList::JobEntry*> remainingJobs = jobs.getJobs();
-
-    // Print the number of jobs to be killed, even if 0.
-    cout << "smash: sending SIGKILL signal to " << remainingJobs.size() << " jobs:" << endl;
-
-    // Iterate through the jobs and send SIGKILL
-    for (JobsList::JobEntry* job : remainingJobs) {
-      cout << job->getPid() << ": " << job->getCmdLine() << endl;
-      if (kill(job->getPid(), SIGKILL) == -1) {
-        perror("smash error: kill failed");
-        // Continue attempting to kill other jobs
+static bool _parseJobIdArg(const ArgList &args, const char *name, int &jobId) {
+  jobId = 0;
+  if (args.size() > 2) {
+    cerr << "smash error: " << name << ": invalid arguments" << endl;
+    return false;
+  }
+  if (args.size() == 2) {
+    try {
+      size_t idx;
+      jobId = stoi(args[1], &idx);
+      if (idx != args[1].size() || jobId <= 0) {
+        throw invalid_argument("job-id");
       }
+    } catch (const exception &e) {
+      cerr << "smash error: " << name << ": invalid arguments" << endl;
+      return false;
     }
-    // After attempting to kill all jobs, the jobs list should be conceptually empty
-    // or reflect that these jobs are no longer managed/active.
-    // Depending on JobsList implementation, a clear() might be needed if getJobs() returns a reference
-    // or if the list isn't automatically cleared by job removal upon termination signals.
-    // For simplicity and to ensure state, explicitly clear.
-    // However, since we are exiting, the state of jobs list in memory becomes less critical.
-    // The main thing is that the processes are signaled.
   }
-
-  // Terminate the shell process
-  exit(0);
+  return true;
 }
 
 /**
- * @brief Executes the KillCommand to send a signal to a specific job's process.
+ * @brief Executes the StopCommand to suspend a running job.
  * 
- * This function validates the input arguments, retrieves the job by its ID, and sends
- * the specified signal to the job's process. If the operation is successful, it prints
- * a confirmation message. Otherwise, it displays appropriate error messages.
+ * This function sends SIGSTOP to the job's process group, so a heavy job can be
+ * paused and later resumed with `bg` or `fg` without losing its progress.
  * 
  * @param None (uses the command-line arguments stored in the `args` member).
- * @return None (outputs success or error messages to standard output or error).
+ * @return None (outputs error messages to standard error if applicable).
  */
-void KillCommand::execute() {
-  // Validate the number of arguments
-  if (args.size() != 3 || args[1][0] != '-') {
-    cerr << "smash error: kill: invalid arguments" << endl;
+void StopCommand::execute() {
+  jobs.removeFinishedJobs();
+
+  int jobId;
+  if (!_parseJobIdArg(args, "stop", jobId)) {
     return;
   }
-
-  // Parse the signal number
-  int signum;
-  try {
-    signum = stoi(args[1].substr(1)); // Remove the '-' and convert to integer
-    if (signum <= 0 || signum >= NSIG) { // Validate signal number range
-      cerr << "smash error: kill: invalid signal number" << endl;
+  if (args.size() == 1) {
+    cerr << "smash error: stop: invalid arguments" << endl;
+    return;
+  }
+  JobsList::JobEntry *job = jobs.getJobById(jobId);
+  if (job == nullptr) {
+    cerr << "smash error: stop: job-id " << jobId << " does not exist" << endl;
+    return;
+  }
+  if (job->isStopped()) {
+    cerr << "smash error: stop: job-id " << jobId << " is already stopped" << endl;
+    return;
+  }
+  if (job->sendGroupSignal(SIGSTOP) == -1) {
+    perror("smash error: kill failed");
+    return;
+  }
+  jobs.setJobStopped(job, true);
+  cout << job->getCmdLine() << " " << job->getPid() << endl;
+}
+
+/**
+ * @brief Executes the BackgroundCommand to resume a stopped job in the background.
+ * 
+ * Without arguments, the stopped job with the largest job ID is resumed.
+ * 
+ * @param None (uses the command-line arguments stored in the `args` member).
+ * @return None (outputs error messages to standard error if applicable).
+ */
+void BackgroundCommand::execute() {
+  jobs.removeFinishedJobs();
+
+  int jobId;
+  if (!_parseJobIdArg(args, "bg", jobId)) {
+    return;
+  }
+  if (jobId == 0) {
+    jobId = jobs.getLargestStoppedJobId();
+    if (jobId == 0) {
+      cerr << "smash error: bg: there are no stopped jobs to resume" << endl;
       return;
     }
-  } catch (const invalid_argument &e) {
-    cerr << "smash error: kill: invalid arguments" << endl;
+  }
+  JobsList::JobEntry *job = jobs.getJobById(jobId);
+  if (job == nullptr) {
+    cerr << "smash error: bg: job-id " << jobId << " does not exist" << endl;
     return;
-  } catch (const out_of_range &e) {
+  }
+  if (!job->isStopped()) {
+    cerr << "smash error: bg: job-id " << jobId << " is already running in the background" << endl;
+    return;
+  }
+  if (job->sendGroupSignal(SIGCONT) == -1) {
+    perror("smash error: kill failed");
+    return;
+  }
+  jobs.setJobStopped(job, false);
+  cout << job->getCmdLine() << " " << job->getPid() << endl;
+}
+
+// Signals a job's whole process group, so children of the job's process
+// (e.g. of bash -c) are signalled too. A group that is already gone is not an error.
+// Only for jobs that have not been reaped: the fallback signals the PID itself.
+static void _signalJobGroup(const JobsList::JobEntry *job, int signum) {
+  if (job->sendGroupSignal(signum) == -1 && job->sendSignal(signum) == -1 && errno != ESRCH) {
+    perror("smash error: kill failed");
+  }
+}
+
+// True if pid has exited. The child is left a zombie (WNOWAIT), so neither its
+// PID nor its process group ID can be reused until it is reaped.
+static bool _hasExited(pid_t pid) {
+  siginfo_t info;
+  info.si_pid = 0;
+  return waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT) == -1 || info.si_pid != 0;
+}
+
+// Process group IDs that have a live (non-zombie) member, from /proc/<pid>/stat
+static unordered_set<pid_t> _liveProcessGroups() {
+  unordered_set<pid_t> groups;
+  DIR *proc = opendir("/proc");
+  if (proc == nullptr) {
+    perror("smash error: opendir failed");
+    return groups;
+  }
+  char buffer[1024];
+  struct dirent *entry;
+  while ((entry = readdir(proc)) != nullptr) {
+    if (entry->d_name[0] < '1' || entry->d_name[0] > '9') {
+      continue;
+    }
+    string stat_path = string("/proc/") + entry->d_name + "/stat";
+    int fd = open(stat_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+      continue; // Exited meanwhile
+    }
+    ssize_t bytes_read = read(fd, buffer, sizeof(buffer) - 1);
+    close(fd);
+    if (bytes_read <= 0) {
+      continue;
+    }
+    buffer[bytes_read] = '\0';
+    // "pid (comm) state ppid pgrp ...": comm may contain spaces and parentheses
+    const char *fields = strrchr(buffer, ')');
+    char state;
+    int ppid, pgrp;
+    if (fields != nullptr && sscanf(fields + 1, " %c %d %d", &state, &ppid, &pgrp) == 3 && state != 'Z') {
+      groups.insert(pgrp);
+    }
+  }
+  closedir(proc);
+  return groups;
+}
+
+/**
+ * @brief Terminates jobs gracefully: SIGTERM first, then SIGKILL to every job's
+ * process group once the grace period ends.
+ * 
+ * Every job is signalled at once and all of them share a single deadline. Exits
+ * are awaited on the jobs' pidfds through one epoll set (or by polling when
+ * pidfds are unavailable), but not reaped: a leader that exited stays a zombie,
+ * so its group ID still names its group when the leftovers of a clean exit (e.g.
+ * a background child that ignores SIGTERM) are killed. A job counts as killed if
+ * its group still had live members then. Every job is reaped before this
+ * function returns.
+ * 
+ * @param jobs The jobs to terminate.
+ * @param grace_seconds How long the jobs get to exit after SIGTERM.
+ * @return None (prints the jobs and a summary of clean and forced exits).
+ */
+static void _terminateJobsGracefully(const vector<JobsList::JobEntry *> &jobs, double grace_seconds) {
+  cout << "smash: sending SIGTERM signal to " << jobs.size() << " jobs:" << endl;
+  int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  bool use_epoll = (epoll_fd != -1);
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    cout << jobs[i]->getPid() << ": " << jobs[i]->getCmdLine() << endl;
+    _signalJobGroup(jobs[i], SIGTERM);
+    if (jobs[i]->isStopped()) {
+      _signalJobGroup(jobs[i], SIGCONT); // A stopped job only handles SIGTERM once continued
+    }
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u32 = i;
+    use_epoll = use_epoll && jobs[i]->getPidFd() >= 0 &&
+                epoll_ctl(epoll_fd, EPOLL_CTL_ADD, jobs[i]->getPidFd(), &event) == 0;
+  }
+
+  struct timespec deadline;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  deadline.tv_sec += static_cast<time_t>(grace_seconds);
+  deadline.tv_nsec += static_cast<long>((grace_seconds - floor(grace_seconds)) * 1e9);
+  if (deadline.tv_nsec >= 1000000000L) {
+    deadline.tv_sec += 1;
+    deadline.tv_nsec -= 1000000000L;
+  }
+
+  vector<bool> exited(jobs.size(), false);
+  size_t remaining = jobs.size();
+  while (remaining > 0) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long timeout_ms = (deadline.tv_sec - now.tv_sec) * 1000L + (deadline.tv_nsec - now.tv_nsec) / 1000000L;
+    if (timeout_ms <= 0) {
+      break;
+    }
+
+    if (use_epoll) {
+      struct epoll_event events[64];
+      int ready = epoll_wait(epoll_fd, events, 64, static_cast<int>(timeout_ms));
+      if (ready == -1 && errno != EINTR) {
+        perror("smash error: epoll_wait failed");
+        break;
+      }
+      for (int e = 0; e < ready; ++e) {
+        size_t i = events[e].data.u32;
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, jobs[i]->getPidFd(), nullptr);
+        if (!exited[i] && _hasExited(jobs[i]->getPid())) {
+          exited[i] = true;
+          --remaining;
+        }
+      }
+    } else {
+      // Without pidfds: poll every job, at most every 10ms
+      for (size_t i = 0; i < jobs.size(); ++i) {
+        if (!exited[i] && _hasExited(jobs[i]->getPid())) {
+          exited[i] = true;
+          --remaining;
+        }
+      }
+      struct timespec pause = {0, min(timeout_ms, 10L) * 1000000L};
+      nanosleep(&pause, nullptr);
+    }
+  }
+  if (epoll_fd != -1 && close(epoll_fd) == -1) {
+    perror("smash error: close failed");
+  }
+
+  // Escalate: SIGKILL every group, then reap the leaders. No leader has been
+  // reaped yet, so every group ID (and PID) is still the job's own.
+  unordered_set<pid_t> live_groups;
+  if (remaining < jobs.size()) {
+    live_groups = _liveProcessGroups(); // Only needed to tell clean exits from leftovers
+  }
+  size_t forced = 0;
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    if (!exited[i] || live_groups.count(jobs[i]->getPid())) {
+      ++forced;
+    }
+    _signalJobGroup(jobs[i], SIGKILL);
+  }
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    waitpid(jobs[i]->getPid(), nullptr, 0);
+  }
+  cout << "smash: " << jobs.size() - forced << " jobs exited cleanly, " << forced << " jobs were killed" << endl;
+}
+
+/**
+ * @brief Executes the QuitCommand to terminate the shell.
+ * 
+ * This function checks if the "kill" argument is provided. If so, it sends a SIGKILL signal
+ * to the process group of every remaining job, prints their details, and reaps them.
+ * With `quit kill --grace SECONDS`, the jobs get SIGTERM first and SIGKILL only if they
+ * are still running after SECONDS. Finally, it exits the shell process.
+ * 
+ * @param None (uses the command-line arguments stored in the `args` member).
+ * @return None (terminates the shell process).
+ */
+void QuitCommand::execute() {
+  // Check if the "kill" argument is provided
+  // As per PDF: "You may assume that the kill argument, if present, will appear first."
+  // "If any number of arguments (other than kill) were provided with this command, they will be ignored."
+  // This means we only care if args[1] is "kill" (and, after it, --grace).
+  bool killFlag = (args.size() > 1 && args[1] == "kill");
+
+  if (killFlag) {
+    double grace_seconds = -1;
+    if (args.size() > 2 && args[2] == "--grace") {
+      char *end = nullptr;
+      if (args.size() > 3) {
+        grace_seconds = strtod(args[3].c_str(), &end);
+      }
+      if (end == nullptr || end == args[3].c_str() || *end != '\0' || !(grace_seconds >= 0)) {
+        cerr << "smash error: quit: invalid arguments" << endl;
+        return;
+      }
+    }
+
+    // As per teacher's note, ensure finished jobs are removed before counting/killing.
+    jobs.removeFinishedJobs(); 
+
+    // Get the list of remaining jobs
+    vector<JobsList::JobEntry*> remainingJobs = jobs.getJobs();
+
+    if (grace_seconds >= 0) {
+      _terminateJobsGracefully(remainingJobs, grace_seconds);
+    } else {
+      // Print the number of jobs to be killed, even if 0.
+      cout << "smash: sending SIGKILL signal to " << remainingJobs.size() << " jobs:" << endl;
+
+      // Send SIGKILL to every job first, then reap them all
+      for (JobsList::JobEntry* job : remainingJobs) {
+        cout << job->getPid() << ": " << job->getCmdLine() << endl;
+        _signalJobGroup(job, SIGKILL);
+      }
+      for (JobsList::JobEntry* job : remainingJobs) {
+        waitpid(job->getPid(), nullptr, 0);
+      }
+    }
+    jobs.clearJobs();
+  }
+
+  // Terminate the shell process
+  exit(0);
+}
+
+/*
+ * A kill selector: a set of jobs named by ID ranges ("3", "3-40", "1,4,7-9"),
+ * by state ("%all", "%stopped", "%running") or by command line ("%?ffmpeg"
+ * matches a substring; a pattern with *, ? or [ is matched as a glob against
+ * the whole command line, e.g. "%?ffmpeg*").
+ */
+struct _JobSelector {
+  enum Kind { IDS, ALL, STOPPED, RUNNING, COMMAND } kind;
+  string text;
+  vector<pair<int, int>> ranges; // Inclusive job ID ranges, for IDS
+  string pattern;                // For COMMAND
+  bool glob;
+  vector<JobsList::JobEntry *> matched;
+
+  bool matches(const JobsList::JobEntry &job) const {
+    switch (kind) {
+      case ALL:
+        return true;
+      case STOPPED:
+        return job.isStopped();
+      case RUNNING:
+        return !job.isStopped();
+      case COMMAND:
+        return glob ? fnmatch(pattern.c_str(), job.getCmdLine().c_str(), 0) == 0
+                    : job.getCmdLine().find(pattern) != string::npos;
+      case IDS:
+        for (const pair<int, int> &range : ranges) {
+          if (job.getJobId() >= range.first && job.getJobId() <= range.second) {
+            return true;
+          }
+        }
+        return false;
+    }
+    return false;
+  }
+};
+
+// Parses a positive job ID made of digits only
+static bool _parseJobId(const string &text, int &jobId) {
+  if (text.empty() || text.size() > 9 || text.find_first_not_of("0123456789") != string::npos) {
+    return false;
+  }
+  jobId = stoi(text);
+  return jobId > 0;
+}
+
+static bool _parseJobSelector(const string &text, _JobSelector &selector) {
+  selector.text = text;
+  selector.glob = false;
+  if (text == "%all") {
+    selector.kind = _JobSelector::ALL;
+  } else if (text == "%stopped") {
+    selector.kind = _JobSelector::STOPPED;
+  } else if (text == "%running") {
+    selector.kind = _JobSelector::RUNNING;
+  } else if (text.compare(0, 2, "%?") == 0 && text.size() > 2) {
+    selector.kind = _JobSelector::COMMAND;
+    selector.pattern = text.substr(2);
+    selector.glob = selector.pattern.find_first_of("*?[") != string::npos;
+  } else {
+    selector.kind = _JobSelector::IDS;
+    stringstream ss(text);
+    string item;
+    while (getline(ss, item, ',')) {
+      size_t dash = item.find('-');
+      int first, last;
+      if (dash == string::npos) {
+        if (!_parseJobId(item, first)) {
+          return false;
+        }
+        last = first;
+      } else if (!_parseJobId(item.substr(0, dash), first) ||
+                 !_parseJobId(item.substr(dash + 1), last) || last < first) {
+        return false;
+      }
+      selector.ranges.push_back(make_pair(first, last));
+    }
+    return !selector.ranges.empty() && text[text.size() - 1] != ',';
+  }
+  return true;
+}
+
+/**
+ * @brief Executes the KillCommand to send a signal to jobs.
+ * 
+ * Usage: kill -<signum> [-g] <selector> [<selector> ...] (see _JobSelector).
+ * All selectors are parsed first and then resolved against the jobs list in a
+ * single pass, so nothing is signalled if any selector is invalid. Each matched
+ * job is signalled once, even if several selectors match it. Signals go
+ * through each job's pidfd, or to the job's process group with -g. One summary
+ * line is printed per selector, counting every job it matched. A single job ID keeps the classic messages.
+ * 
+ * @param None (uses the command-line arguments stored in the `args` member).
+ * @return None (outputs success or error messages to standard output or error).
+ */
+void KillCommand::execute() {
+  // Validate the number of arguments
+  if (args.size() < 3 || args[1][0] != '-') {
     cerr << "smash error: kill: invalid arguments" << endl;
     return;
   }
 
-  // Parse the job ID
-  int jobId;
+  // Parse the signal number
+  int signum;
   try {
-    jobId = stoi(args[2]);
-    if (jobId <= 0) { // Validate job ID is positive
-      cerr << "smash error: kill: invalid arguments" << endl;
+    signum = stoi(args[1].substr(1)); // Remove the '-' and convert to integer
+    if (signum <= 0 || signum >= NSIG) { // Validate signal number range
+      cerr << "smash error: kill: invalid signal number" << endl;
       return;
     }
   } catch (const invalid_argument &e) {
@@ -575,21 +1432,267 @@ void KillCommand::execute() {
     return;
   }
 
-  // Find the job by ID
-  JobsList::JobEntry *job = jobs.getJobById(jobId);
-  if (!job) {
-    cerr << "smash error: kill: job-id " << jobId << " does not exist" << endl;
+  size_t first_selector = 2;
+  bool to_group = false;
+  if (args[2] == "-g") {
+    to_group = true;
+    first_selector = 3;
+  }
+
+  // Classic form: kill -<signum> <job-id>
+  int jobId;
+  if (!to_group && args.size() == 3 && _parseJobId(args[2], jobId)) {
+    JobsList::JobEntry *job = jobs.getJobById(jobId);
+    if (!job) {
+      cerr << "smash error: kill: job-id " << jobId << " does not exist" << endl;
+      return;
+    }
+    if (job->sendSignal(signum) == -1) {
+      perror("smash error: kill failed");
+      return;
+    }
+    cout << "signal number " << signum << " was sent to pid " << job->getPid() << endl;
     return;
   }
 
-  // Send the signal to the job's process
-  if (kill(job->getPid(), signum) == -1) {
-    perror("smash error: kill failed");
+  // Parse every selector before signalling anything
+  vector<_JobSelector> selectors(args.size() - first_selector);
+  if (selectors.empty()) {
+    cerr << "smash error: kill: invalid arguments" << endl;
+    return;
+  }
+  for (size_t i = 0; i < selectors.size(); ++i) {
+    if (!_parseJobSelector(args[first_selector + i], selectors[i])) {
+      cerr << "smash error: kill: invalid arguments" << endl;
+      return;
+    }
+  }
+
+  // Resolve all selectors in one pass over the jobs list
+  // A job matched by several selectors is signalled once
+  unordered_map<const JobsList::JobEntry *, bool> delivered;
+  for (JobsList::JobEntry *job : jobs.getJobs()) {
+    bool matched = false;
+    for (_JobSelector &selector : selectors) {
+      if (selector.matches(*job)) {
+        selector.matched.push_back(job);
+        matched = true;
+      }
+    }
+    if (matched) {
+      int result = to_group ? job->sendGroupSignal(signum) : job->sendSignal(signum);
+      if (result == -1) {
+        perror("smash error: kill failed");
+      }
+      delivered[job] = (result != -1);
+    }
+  }
+
+  for (const _JobSelector &selector : selectors) {
+    if (selector.matched.empty()) {
+      cerr << "smash error: kill: no jobs match " << selector.text << endl;
+      continue;
+    }
+    size_t sent = 0;
+    for (const JobsList::JobEntry *job : selector.matched) {
+      if (delivered[job]) {
+        ++sent;
+      }
+    }
+    cout << "signal number " << signum << " was sent to " << sent << " of " << selector.matched.size()
+         << (to_group ? " process groups" : " jobs") << " matching " << selector.text << endl;
+  }
+}
+
+/**
+ * @brief Executes the WaitCommand: waits for jobs to finish.
+ * 
+ * Usage: wait [-n] [job-id ...]. Without job IDs it waits for all jobs; with -n it
+ * returns as soon as any one of them finishes. The jobs' pidfds are registered in
+ * a single epoll instance, so any number of jobs is waited for without polling.
+ * Jobs without a pidfd are waited for with waitpid instead. Ctrl-C stops waiting.
+ * A stopped job would never finish, so it is reported and not waited for, whether
+ * it was stopped already or stops during the wait (seen through the SIGCHLD pipe).
+ * 
+ * @param None (uses the command-line arguments stored in the `args` member).
+ * @return None (outputs error messages to standard error if applicable).
+ */
+void WaitCommand::execute() {
+  size_t first_id_arg = 1;
+  bool wait_any = false;
+  if (args.size() > 1 && args[1] == "-n") {
+    wait_any = true;
+    first_id_arg = 2;
+  }
+
+  // Collect the job IDs to wait for
+  vector<int> job_ids;
+  bool wait_all = (args.size() == first_id_arg);
+  if (wait_all) {
+    for (JobsList::JobEntry *job : jobs.getJobs()) {
+      if (!job->isStopped()) { // A stopped job would never finish
+        job_ids.push_back(job->getJobId());
+      }
+    }
+  }
+  for (size_t i = first_id_arg; i < args.size(); ++i) {
+    int job_id;
+    try {
+      job_id = stoi(args[i]);
+    } catch (const invalid_argument &e) {
+      cerr << "smash error: wait: invalid arguments" << endl;
+      return;
+    } catch (const out_of_range &e) {
+      cerr << "smash error: wait: invalid arguments" << endl;
+      return;
+    }
+    JobsList::JobEntry *job = jobs.getJobById(job_id);
+    if (job == nullptr) {
+      cerr << "smash error: wait: job-id " << job_id << " does not exist" << endl;
+      continue;
+    }
+    if (job->isStopped()) {
+      cerr << "smash error: wait: job-id " << job_id << " is stopped" << endl;
+      continue;
+    }
+    job_ids.push_back(job_id);
+  }
+  if (job_ids.empty()) {
     return;
   }
 
-  // Print success message
-  cout << "signal number " << signum << " was sent to pid " << job->getPid() << endl;
+  // The jobs are tracked by PID: an ID can be reused by a queued line started meanwhile
+  vector<pid_t> pending;
+  for (int job_id : job_ids) {
+    pending.push_back(jobs.getJobById(job_id)->getPid());
+  }
+
+  // Register every pidfd in one epoll set
+  int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  bool use_epoll = (epoll_fd != -1);
+  for (size_t i = 0; use_epoll && i < pending.size(); ++i) {
+    JobsList::JobEntry *job = jobs.getJobByPid(pending[i]);
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u32 = job->getPid();
+    use_epoll = job->getPidFd() >= 0 && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, job->getPidFd(), &event) == 0;
+  }
+  // A pidfd only becomes readable on exit; a job that stops is seen through the SIGCHLD pipe
+  // (PID 0 marks it in the set)
+  if (use_epoll && getChildEventFd() != -1) {
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u32 = 0;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, getChildEventFd(), &event);
+  }
+
+  consumeCtrlC(); // Only a ctrl-C pressed from now on interrupts the wait
+  while (!pending.empty()) {
+    // A job the SIGCHLD reaper collected meanwhile (e.g. while a queued line was
+    // started) is already in the history, and closing its pidfd left the epoll set.
+    // A job that stopped is reported and no longer waited for.
+    size_t before = pending.size();
+    for (size_t i = 0; i < pending.size();) {
+      JobsList::JobEntry *job = jobs.getJobByPid(pending[i]);
+      if (job != nullptr && !job->isStopped()) {
+        ++i;
+        continue;
+      }
+      if (job != nullptr) {
+        cerr << "smash error: wait: job-id " << job->getJobId() << " is stopped" << endl;
+        if (use_epoll) {
+          epoll_ctl(epoll_fd, EPOLL_CTL_DEL, job->getPidFd(), nullptr);
+        }
+      }
+      pending[i] = pending.back();
+      pending.pop_back();
+    }
+    if (pending.empty() || (wait_any && pending.size() < before)) {
+      break;
+    }
+
+    pid_t finished_pid;
+    int status = 0;
+    struct rusage usage;
+    memset(&usage, 0, sizeof(usage));
+    if (use_epoll) {
+      struct epoll_event event;
+      int ready = epoll_wait(epoll_fd, &event, 1, -1);
+      if (ready == -1) {
+        if (errno == EINTR && !consumeCtrlC()) {
+          continue;
+        }
+        if (errno != EINTR) {
+          perror("smash error: epoll_wait failed");
+        }
+        break;
+      }
+      finished_pid = event.data.u32;
+      if (finished_pid == 0) {
+        drainChildEventFd();
+        jobs.removeFinishedJobs(); // Records stops (and exits the pidfds have not reported yet)
+        continue;
+      }
+      JobsList::JobEntry *job = jobs.getJobByPid(finished_pid);
+      epoll_ctl(epoll_fd, EPOLL_CTL_DEL, job->getPidFd(), nullptr);
+      if (wait4(finished_pid, &status, WNOHANG, &usage) == finished_pid) {
+        jobs.finishJob(job->getJobId(), status, usage, _monotonicNow());
+      } else {
+        // Not waitable (0), or already reaped by the SIGCHLD reaper (ECHILD): the
+        // reaper records the exit, with the time its SIGCHLD arrived
+        jobs.removeFinishedJobs();
+      }
+    } else {
+      // Fallback without pidfds: reap children until one of ours finishes or stops
+      finished_pid = wait4(-1, &status, WUNTRACED, &usage);
+      if (finished_pid == -1) {
+        if (errno == EINTR && !consumeCtrlC()) {
+          continue;
+        }
+        if (errno != EINTR) {
+          perror("smash error: waitpid failed");
+        }
+        break;
+      }
+      JobsList::JobEntry *job = jobs.getJobByPid(finished_pid);
+      if (job == nullptr) {
+        continue;
+      }
+      if (WIFSTOPPED(status)) {
+        jobs.setJobStopped(job, true); // Reported at the top of the loop
+        continue;
+      }
+      jobs.finishJob(job->getJobId(), status, usage, _monotonicNow());
+      if (find(pending.begin(), pending.end(), finished_pid) == pending.end()) {
+        continue; // Reaped, but not one we are waiting for
+      }
+    }
+    pending.erase(find(pending.begin(), pending.end(), finished_pid));
+    if (wait_any) {
+      break;
+    }
+
+    // The freed slot may start queued commands; waiting for all jobs covers them too
+    vector<int> started = SmallShell::getInstance().startQueuedJobs();
+    for (int job_id : started) {
+      JobsList::JobEntry *job = jobs.getJobById(job_id);
+      if (!wait_all || job == nullptr) {
+        continue;
+      }
+      struct epoll_event event;
+      event.events = EPOLLIN;
+      event.data.u32 = job->getPid();
+      if (use_epoll && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, job->getPidFd(), &event) == -1) {
+        perror("smash error: epoll_ctl failed");
+        continue;
+      }
+      pending.push_back(job->getPid());
+    }
+  }
+
+  if (epoll_fd != -1 && close(epoll_fd) == -1) {
+    perror("smash error: close failed");
+  }
 }
 
 /**
@@ -619,7 +1722,7 @@ void AliasCommand::execute() {
   // Case 2: Handle alias creation (alias <name>='<command>')
   // This part assumes CreateCommand passed a string that either is "alias" 
   // or starts with "alias " but might not be a fully valid definition yet.
-  // The regex check in CreateCommand handles strictly valid definitions.
+  // _isAliasDefinition in CreateCommand handles strictly valid definitions.
   // This code handles cases like "alias name" or "alias name=" which are invalid.
 
   size_t equalPos = commandLine.find('=');
@@ -633,7 +1736,7 @@ void AliasCommand::execute() {
   string aliasCommandWithQuotes = _trim(commandLine.substr(equalPos + 1));
 
   // Validate alias name format (alphanumeric and underscores)
-  if (aliasName.empty() || !regex_match(aliasName, regex("^[a-zA-Z0-9_]+$"))) {
+  if (!_isAliasName(aliasName)) {
     cerr << "smash error: alias: invalid alias format" << endl;
     return;
   }
@@ -655,26 +1758,103 @@ void AliasCommand::execute() {
   //   return;
   // }
 
-  // Check for reserved keywords
-  static const set<string> reservedKeywords = {
-    "quit", "fg", "bg", "jobs", "kill", "cd", "listdir", "chprompt", "alias", "unalias", "pwd", "showpid", "du", "whoami", "watchproc", "unsetenv"
-    // "listdir" might be an example, ensure this list matches your actual built-in commands.
-    // Added "bg" as it's a common shell command, though not explicitly in the PDF's list for this homework.
-    // For safety, stick to the PDF's examples or your implemented commands.
-    // The PDF example was "eg., `quit`, `lisdir` etc…)", so the current list is a good interpretation.
-  };
+  // Check for reserved keywords: every registered built-in, plus a few
+  // common shell commands that are not implemented here.
+  bool reserved = _lookupBuiltin(aliasName.c_str()) != nullptr || aliasName == "listdir";
 
-  if (reservedKeywords.count(aliasName) || aliasMap.count(aliasName)) {
+  if (reserved || aliasMap.count(aliasName)) {
     cerr << "smash error: alias: " << aliasName << " already exists or is a reserved command" << endl;
     return;
   }
 
-  // Add the alias to the map
-  aliasMap[aliasName] = aliasCommandValue;
+  // Add the alias to the map (rejects loops and refreshes the expansions)
+  SmallShell::getInstance().setAlias(aliasName, aliasCommandValue);
+}
+
+// First word of an alias command
+static string _aliasHead(const string &aliasCommand) {
+  string trimmed = _ltrim(aliasCommand);
+  return trimmed.substr(0, trimmed.find_first_of(WHITESPACE));
 }
 
 /**
- * @brief Adds or updates an alias in the alias map.
+ * @brief Checks whether defining an alias would make the alias graph cyclic.
+ * 
+ * Follows the chain of first words starting at the new command. An alias whose
+ * command starts with its own name (e.g. ls='ls -l') refers to the real command,
+ * like in bash; only the degenerate a='a' and chains leading back through other
+ * aliases (a -> b -> a) are loops. The existing graph is acyclic, so the walk ends.
+ * 
+ * @param aliasName The name of the alias being defined.
+ * @param aliasCommand The command associated with the alias.
+ * @return True if the definition would create a loop.
+ */
+bool SmallShell::createsAliasLoop(const string& aliasName, const string& aliasCommand) const {
+  if (_trim(aliasCommand) == aliasName) {
+    return true;
+  }
+  string head = _aliasHead(aliasCommand);
+  if (head == aliasName) {
+    return false;
+  }
+  auto it = aliasMap.find(head);
+  while (it != aliasMap.end()) {
+    string next = _aliasHead(it->second);
+    if (next == aliasName) {
+      return true;
+    }
+    if (next == it->first) {
+      break;
+    }
+    it = aliasMap.find(next);
+  }
+  return false;
+}
+
+/**
+ * @brief Returns the fully expanded command of an alias, memoized in aliasExpansions.
+ * 
+ * The first word of the alias command is expanded again if it is itself an alias
+ * (other than the alias being expanded), recursively.
+ * 
+ * @param aliasName The name of an existing alias.
+ * @return The expanded command.
+ */
+const string &SmallShell::expandAlias(const string& aliasName) {
+  auto memo = aliasExpansions.find(aliasName);
+  if (memo != aliasExpansions.end()) {
+    return memo->second;
+  }
+
+  const string &aliasCommand = aliasMap[aliasName];
+  string head = _aliasHead(aliasCommand);
+  string expansion = aliasCommand;
+  if (head != aliasName && aliasMap.count(head)) {
+    string rest = _ltrim(aliasCommand).substr(head.length());
+    expansion = expandAlias(head) + rest;
+  }
+  return aliasExpansions[aliasName] = expansion;
+}
+
+/**
+ * @brief Recomputes the flattened expansion of every alias.
+ * 
+ * Called whenever the alias map changes. Cached parsed commands depend on the
+ * expansions, so the command cache is cleared as well.
+ * 
+ * @param None.
+ * @return None.
+ */
+void SmallShell::rebuildAliasExpansions() {
+  aliasExpansions.clear();
+  for (const auto &alias : aliasMap) {
+    expandAlias(alias.first);
+  }
+  commandCache.clear();
+}
+
+/**
+ * @brief Adds or updates an alias in the alias map.
  * 
  * This function checks for alias loops and adds the alias to the map.
  * 
@@ -683,11 +1863,12 @@ void AliasCommand::execute() {
  * @return None (outputs error messages if a loop is detected).
  */
 void SmallShell::setAlias(const string& aliasName, const string& aliasCommand) {
-  if (aliasCommand == aliasName) {
+  if (createsAliasLoop(aliasName, aliasCommand)) {
     cerr << "smash error: alias: alias loop detected" << endl;
     return;
   }
   aliasMap[aliasName] = aliasCommand;
+  rebuildAliasExpansions();
 }
 
 /**
@@ -702,7 +1883,9 @@ void SmallShell::setAlias(const string& aliasName, const string& aliasCommand) {
 void SmallShell::removeAlias(const string& aliasName) {
   if (aliasMap.erase(aliasName) == 0) {
     cerr << "smash error: unalias: alias \"" << aliasName << "\" does not exist" << endl;
+    return;
   }
+  rebuildAliasExpansions();
 }
 
 /**
@@ -737,6 +1920,244 @@ void SmallShell::printAliases() const {
   }
 }
 
+/*******************************************************
+ *                  STARTUP FILE (~/.smashrc)          *
+ *******************************************************/
+
+/*
+ * Binary snapshot of a compiled rc file, stored next to it as ~/.smashrc.snap.
+ * Layout: RcSnapshotHeader, the prompt, then alias_count (name, command) and
+ * env_count (name, value) records, each string prefixed by its uint32_t length.
+ */
+struct RcSnapshotHeader {
+  char magic[4];
+  uint32_t version;
+  int64_t rc_mtime_sec;
+  int64_t rc_mtime_nsec;
+  uint64_t rc_size;
+  uint32_t alias_count;
+  uint32_t env_count;
+};
+
+static const char RC_SNAPSHOT_MAGIC[4] = {'S', 'M', 'R', 'C'};
+
+// Bounds-checked reader over the mmapped snapshot
+class RcSnapshotReader {
+  const char *pos;
+  const char *end;
+
+public:
+  RcSnapshotReader(const char *begin, size_t size) : pos(begin), end(begin + size) {}
+
+  size_t remaining() const { return end - pos; }
+
+  bool readString(string &out) {
+    uint32_t len;
+    if (static_cast<size_t>(end - pos) < sizeof(len)) {
+      return false;
+    }
+    memcpy(&len, pos, sizeof(len));
+    pos += sizeof(len);
+    if (static_cast<size_t>(end - pos) < len) {
+      return false;
+    }
+    out.assign(pos, len);
+    pos += len;
+    return true;
+  }
+};
+
+static void _appendSnapshotString(string &out, const string &value) {
+  uint32_t len = value.size();
+  out.append(reinterpret_cast<const char *>(&len), sizeof(len));
+  out.append(value);
+}
+
+/**
+ * @brief Applies a binary rc snapshot if it is up to date with the rc file.
+ * 
+ * The snapshot is mmapped and accepted only if its magic, version, and the
+ * recorded mtime and size of the rc file all match.
+ * 
+ * @param snapshotPath Path of the snapshot file.
+ * @param rcStat The current stat of the rc file.
+ * @return True if the snapshot was valid and applied.
+ */
+bool SmallShell::loadRcSnapshot(const string &snapshotPath, const struct stat &rcStat) {
+  int fd = open(snapshotPath.c_str(), O_RDONLY);
+  if (fd == -1) {
+    return false;
+  }
+  struct stat snapStat;
+  if (fstat(fd, &snapStat) == -1 || static_cast<size_t>(snapStat.st_size) < sizeof(RcSnapshotHeader)) {
+    close(fd);
+    return false;
+  }
+  size_t size = snapStat.st_size;
+  void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    return false;
+  }
+
+  const char *data = static_cast<const char *>(mapped);
+  RcSnapshotHeader header;
+  memcpy(&header, data, sizeof(header));
+  bool valid = memcmp(header.magic, RC_SNAPSHOT_MAGIC, sizeof(header.magic)) == 0 &&
+               header.version == RC_SNAPSHOT_VERSION &&
+               header.rc_mtime_sec == rcStat.st_mtim.tv_sec &&
+               header.rc_mtime_nsec == rcStat.st_mtim.tv_nsec &&
+               header.rc_size == static_cast<uint64_t>(rcStat.st_size);
+
+  // Decode everything before touching the shell state, so a truncated
+  // snapshot falls back to compiling the rc file. The counts come from the
+  // file, so they are checked against its size before anything is allocated:
+  // the prompt and every name and value take at least a length prefix.
+  RcSnapshotReader reader(data + sizeof(header), size - sizeof(header));
+  uint64_t minBytes = sizeof(uint32_t) * (1 + 2 * (static_cast<uint64_t>(header.alias_count) + header.env_count));
+  valid = valid && minBytes <= reader.remaining();
+  string newPrompt;
+  vector<pair<string, string>> aliases(valid ? header.alias_count : 0);
+  vector<pair<string, string>> env(valid ? header.env_count : 0);
+  valid = valid && reader.readString(newPrompt);
+  for (size_t i = 0; valid && i < aliases.size(); ++i) {
+    valid = reader.readString(aliases[i].first) && reader.readString(aliases[i].second);
+  }
+  for (size_t i = 0; valid && i < env.size(); ++i) {
+    valid = reader.readString(env[i].first) && reader.readString(env[i].second);
+  }
+  munmap(mapped, size);
+  if (!valid) {
+    return false;
+  }
+
+  prompt = newPrompt;
+  for (const auto &alias : aliases) {
+    aliasMap[alias.first] = alias.second;
+  }
+  rebuildAliasExpansions();
+  for (const auto &var : env) {
+    setenv(var.first.c_str(), var.second.c_str(), 1);
+  }
+  return true;
+}
+
+/**
+ * @brief Runs the rc file line by line.
+ * 
+ * Supported lines are alias definitions, chprompt and `export NAME=VALUE`.
+ * Blank lines and lines starting with '#' are skipped.
+ * 
+ * @param rcPath Path of the rc file.
+ * @param envOverrides Filled with the environment variables set by the file.
+ * @return None (outputs error messages for unsupported lines).
+ */
+void SmallShell::compileRcFile(const string &rcPath, vector<pair<string, string>> &envOverrides) {
+  ifstream rc(rcPath);
+  string line;
+  int lineNumber = 0;
+  while (getline(rc, line)) {
+    ++lineNumber;
+    string trimmed = _trim(line);
+    if (trimmed.empty() || trimmed[0] == '#') {
+      continue;
+    }
+    string firstWord = trimmed.substr(0, trimmed.find_first_of(WHITESPACE));
+    if (firstWord == "alias" || firstWord == "chprompt") {
+      executeCommand(trimmed.c_str());
+    } else if (firstWord == "export") {
+      string assignment = _trim(trimmed.substr(firstWord.length()));
+      size_t equalPos = assignment.find('=');
+      if (equalPos == string::npos || equalPos == 0) {
+        cerr << "smash error: " << RC_FILE_NAME << ": line " << lineNumber << ": invalid export" << endl;
+        continue;
+      }
+      string name = assignment.substr(0, equalPos);
+      string value = assignment.substr(equalPos + 1);
+      setenv(name.c_str(), value.c_str(), 1);
+      envOverrides.push_back(make_pair(name, value));
+    } else {
+      cerr << "smash error: " << RC_FILE_NAME << ": line " << lineNumber << ": unsupported command" << endl;
+    }
+  }
+}
+
+/**
+ * @brief Writes the current prompt, aliases and the rc environment overrides as a snapshot.
+ * 
+ * The snapshot is written to a temporary file and renamed into place, so a
+ * concurrently starting smash never maps a partial file.
+ * 
+ * @param snapshotPath Path of the snapshot file.
+ * @param rcStat The stat of the rc file the snapshot was compiled from.
+ * @param envOverrides The environment variables set by the rc file.
+ * @return None (failures are ignored; the rc file is simply compiled next time).
+ */
+void SmallShell::writeRcSnapshot(const string &snapshotPath, const struct stat &rcStat,
+                                 const vector<pair<string, string>> &envOverrides) const {
+  RcSnapshotHeader header;
+  memcpy(header.magic, RC_SNAPSHOT_MAGIC, sizeof(header.magic));
+  header.version = RC_SNAPSHOT_VERSION;
+  header.rc_mtime_sec = rcStat.st_mtim.tv_sec;
+  header.rc_mtime_nsec = rcStat.st_mtim.tv_nsec;
+  header.rc_size = rcStat.st_size;
+  header.alias_count = aliasMap.size();
+  header.env_count = envOverrides.size();
+
+  string out(reinterpret_cast<const char *>(&header), sizeof(header));
+  _appendSnapshotString(out, prompt);
+  for (const auto &alias : aliasMap) {
+    _appendSnapshotString(out, alias.first);
+    _appendSnapshotString(out, alias.second);
+  }
+  for (const auto &var : envOverrides) {
+    _appendSnapshotString(out, var.first);
+    _appendSnapshotString(out, var.second);
+  }
+
+  string tmpPath = snapshotPath + ".tmp." + to_string(getpid());
+  int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    return;
+  }
+  bool ok = write(fd, out.data(), out.size()) == static_cast<ssize_t>(out.size());
+  ok = (close(fd) == 0) && ok;
+  if (!ok || rename(tmpPath.c_str(), snapshotPath.c_str()) == -1) {
+    unlink(tmpPath.c_str());
+  }
+}
+
+/**
+ * @brief Loads ~/.smashrc at startup.
+ * 
+ * If ~/.smashrc.snap matches the rc file's mtime and size it is applied directly;
+ * otherwise the rc file is compiled and a fresh snapshot is written next to it.
+ * A missing rc file is not an error.
+ * 
+ * @param None.
+ * @return None.
+ */
+void SmallShell::loadRcFile() {
+  const char *home = getenv("HOME");
+  if (home == nullptr || *home == '\0') {
+    return;
+  }
+  string rcPath = string(home) + "/" + RC_FILE_NAME;
+  struct stat rcStat;
+  if (stat(rcPath.c_str(), &rcStat) == -1 || !S_ISREG(rcStat.st_mode)) {
+    return;
+  }
+
+  string snapshotPath = rcPath + RC_SNAPSHOT_SUFFIX;
+  if (loadRcSnapshot(snapshotPath, rcStat)) {
+    return;
+  }
+
+  vector<pair<string, string>> envOverrides;
+  compileRcFile(rcPath, envOverrides);
+  writeRcSnapshot(snapshotPath, rcStat, envOverrides);
+}
+
 /**
  * @brief Removes one or more aliases from the alias map.
  * 
@@ -765,7 +2186,7 @@ void UnAliasCommand::execute() {
     }
 
     // Remove the alias from the map
-    aliasMap.erase(aliasName);
+    SmallShell::getInstance().removeAlias(aliasName);
   }
 }
 
@@ -869,6 +2290,91 @@ void UnSetEnvCommand::execute() {
   }
 }
 
+/**
+ * @brief Executes the HashCommand to show or manage the PATH resolution cache.
+ * 
+ * `hash` lists the cached commands with their hit counts and paths, `hash -r`
+ * clears the cache, and `hash <name>...` resolves the names now (pre-warming
+ * the cache). As in bash, `hash -r` is needed after installing a command into
+ * a PATH directory that precedes the one it is cached from.
+ * 
+ * @param None (uses the command-line arguments stored in the `args` member).
+ * @return None (outputs results or error messages to standard output or error).
+ */
+void HashCommand::execute() {
+  PathCache &cache = SmallShell::getInstance().getPathCache();
+  if (args.size() == 1) {
+    if (cache.getEntries().empty()) {
+      cout << "hash: hash table empty" << endl;
+      return;
+    }
+    cout << "hits\tcommand" << endl;
+    for (const auto &entry : cache.getEntries()) {
+      cout << setw(4) << entry.second.hits << "\t" << entry.second.path << endl;
+    }
+    return;
+  }
+  if (args[1] == "-r") {
+    cache.clear();
+    return;
+  }
+  for (size_t i = 1; i < args.size(); ++i) {
+    if (cache.resolve(args[i]) == nullptr) {
+      cerr << "smash error: hash: " << args[i] << ": not found" << endl;
+    }
+  }
+}
+
+/**
+ * @brief Prints the hit rate and occupancy of the parsed-command cache.
+ * 
+ * @param None.
+ * @return None (outputs the statistics to standard output).
+ */
+void CacheStatsCommand::execute() {
+  CommandCache &cache = SmallShell::getInstance().getCommandCache();
+  unsigned long long lookups = cache.getHits() + cache.getMisses();
+  double hit_rate = (lookups == 0) ? 0.0 : 100.0 * cache.getHits() / lookups;
+  cout << "command cache: " << cache.getHits() << " hits, " << cache.getMisses() << " misses ("
+       << fixed << setprecision(1) << hit_rate << "% hit rate), "
+       << cache.size() << "/" << cache.getCapacity() << " entries" << endl;
+}
+
+/**
+ * @brief Executes the JobSlotsCommand to show or set the maximal number of jobs.
+ * 
+ * `jobslots` prints the current limit, `jobslots N` allows at most N running
+ * jobs (0 removes the limit). Background commands beyond the limit are queued
+ * and start as soon as a job exits or stops; raising the limit starts queued
+ * commands at once.
+ * 
+ * @param None (uses the command-line arguments stored in the `args` member).
+ * @return None (outputs results or error messages to standard output or error).
+ */
+void JobSlotsCommand::execute() {
+  if (args.size() == 1) {
+    if (jobs.getSlotLimit() == 0) {
+      cout << "jobslots: unlimited" << endl;
+    } else {
+      cout << "jobslots: " << jobs.getSlotLimit() << endl;
+    }
+    return;
+  }
+  int limit;
+  try {
+    size_t idx;
+    limit = stoi(args[1], &idx);
+    if (args.size() > 2 || idx != args[1].size() || limit < 0) {
+      throw invalid_argument("jobslots");
+    }
+  } catch (const exception &e) {
+    cerr << "smash error: jobslots: invalid arguments" << endl;
+    return;
+  }
+  jobs.setSlotLimit(limit);
+  SmallShell::getInstance().startQueuedJobs();
+}
+
 /**
  * @brief Monitors the CPU and memory usage of a specific process.
  * 
@@ -924,9 +2430,11 @@ void WatchProcCommand::execute() {
 
   // Wait for 1 second to calculate deltas
   struct timespec req = {1, 0}; // 1 second, 0 nanoseconds
-  if (nanosleep(&req, nullptr) == -1) {
-    perror("smash error: nanosleep failed");
-    return;
+  while (nanosleep(&req, &req) == -1) {
+    if (errno != EINTR) { // e.g. SIGCHLD from a background job
+      perror("smash error: nanosleep failed");
+      return;
+    }
   }
   
   // Read current CPU and system times
@@ -1096,131 +2604,690 @@ double WatchProcCommand::readMemoryUsage(pid_t pid) {
  *******************************************************/
 
 /**
- * @brief Executes an external command, handling both foreground and background processes.
+ * @brief Executes an external command, queueing it if it is a background
+ * command and every job slot is taken.
  * 
- * This function forks a child process to execute the command. For foreground commands,
- * the parent process waits for the child to finish. For background commands, the child
- * process is added to the jobs list. The child process is separated into its own process group.
+ * A queued command is started by SmallShell::startQueuedJobs once a job is
+ * reaped. Queued commands start in order, so a new command is queued behind
+ * any that are already waiting.
  * 
  * @param None (uses the command-line arguments stored in the `cmd_line` member).
  * @return None (outputs errors to standard error if applicable).
  */
-void SimpleExternalCommand::execute() {
-  pid_t pid = fork();
-  if (pid < 0) {
-    perror("smash error: fork failed");
-    return;
+void ExternalCommand::execute() {
+  if (is_background) {
+    jobs.removeFinishedJobs();
+    if (jobs.hasQueuedJobs() || !jobs.hasFreeSlot()) {
+      jobs.queueJob(cmd_line_unedited);
+      return;
+    }
   }
+  launch();
+}
 
-  if (pid == 0) {
-    // Child process
-    setpgrp();
+/**
+ * @brief Runs an external command, handling both foreground and background processes.
+ * 
+ * This function starts the command in its own process group through spawn().
+ * For foreground commands, the parent process waits for the child to finish (or
+ * stop). For background commands, the child process is added to the jobs list.
+ * 
+ * @param None (uses the command-line arguments stored in the `cmd_line` member).
+ * @return None (outputs errors to standard error if applicable).
+ */
+void ExternalCommand::launch() {
+  if (is_background) {
+    jobs.removeFinishedJobs(); // Before starting the job, see JobsList::addJob
+  }
+  pid_t pid = spawn(0, -1, stdout_fd, STDOUT_FILENO);
+  if (pid == -1) {
+    return;
+  }
 
-    string cmd_line_copy = cmd_line;
-    if (is_background) {
-      _removeBackgroundSign(&cmd_line_copy[0]);
+  SmallShell &smash = SmallShell::getInstance();
+  if (!is_background) {
+    // Foreground execution: Wait for the child process to finish
+    smash.setForegroundPid(pid);
+    int status;
+    if (smash.waitForeground(pid, &status) == -1) {
+      perror("smash error: waitpid failed");
+    } else if (WIFSTOPPED(status)) {
+      jobs.removeFinishedJobs(); // See JobsList::addJob
+      jobs.addJob(cmd_line_unedited, pid, true, policy.description);
     }
+    smash.clearForegroundPid(); // Clear the foreground PID after the process finishes
+  } else {
+    // Background execution: Add the job to the jobs list
+    jobs.addJob(cmd_line_unedited, pid, false, policy.description);
+  }
+}
 
-    char *args[COMMAND_MAX_ARGS + 1];
-    int argsCount = _parseCommandLine(cmd_line_copy.c_str(), args);
-    args[argsCount] = nullptr;
-
-    if (execvp(args[0], args) == -1) {
-      perror("smash error: execvp failed");
-
-      // Free allocated memory before exiting
-      for (int i = 0; i < argsCount; ++i) {
-        free(args[i]);
+/**
+ * @brief Starts the command in a new process without waiting for it.
+ * 
+ * Without a policy, the process is created with posix_spawnp: the argv is built
+ * here in the parent, the process group is a spawn attribute and in_fd/out_fd are
+ * dup2 file actions. glibc spawns through a CLONE_VM|CLONE_VFORK child, so no page
+ * tables are copied. With a policy (run), the child is forked so that
+ * RunCommand::execChild can apply it before exec.
+ * 
+ * The caller should open in_fd/out_fd with O_CLOEXEC, so that only their
+ * dup2 copies reach the command.
+ * 
+ * @param pgid The process group to join, or 0 for a new group led by the child.
+ * @param in_fd If not -1, becomes the child's stdin.
+ * @param out_fd If not -1, becomes the child's out_target.
+ * @param out_target STDOUT_FILENO or STDERR_FILENO.
+ * @return The child's PID, or -1 if it could not be started.
+ */
+pid_t ExternalCommand::spawn(pid_t pgid, int in_fd, int out_fd, int out_target) {
+  if (!policy.empty()) {
+    pid_t pid = fork();
+    if (pid == -1) {
+      perror("smash error: fork failed");
+      return -1;
+    }
+    if (pid == 0) {
+      setpgid(0, pgid);
+      if ((in_fd != -1 && dup2(in_fd, STDIN_FILENO) == -1) ||
+          (out_fd != -1 && dup2(out_fd, out_target) == -1)) {
+        perror("smash error: dup2 failed");
+        exit(1);
       }
-      return;
+      execChild();
     }
+    // Mirror the child's setpgid, so the group exists as soon as we return
+    setpgid(pid, pgid == 0 ? pid : pgid);
+    return pid;
+  }
 
-    // Free allocated memory (in case execvp fails unexpectedly)
-    for (int i = 0; i < argsCount; ++i) {
-      free(args[i]);
-    }
-    return;
-  } else {
-    // Parent process
-    SmallShell &smash = SmallShell::getInstance();
+  vector<char *> argv;
+  string storage;
+  buildArgv(argv, storage);
+  if (argv.empty() || argv[0] == nullptr) {
+    return -1;
+  }
 
-    if (!is_background) {
-      // Foreground execution: Wait for the child process to finish
-      smash.setForegroundPid(pid);
-      int status;
-      if (waitpid(pid, &status, 0) == -1) {
-        perror("smash error: waitpid failed");
-      }
-      smash.clearForegroundPid(); // Clear the foreground PID after the process finishes
+  posix_spawnattr_t attr;
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_init(&attr);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+  posix_spawnattr_setpgroup(&attr, pgid);
+  posix_spawn_file_actions_init(&actions);
+  if (in_fd != -1) {
+    posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+  }
+  if (out_fd != -1) {
+    posix_spawn_file_actions_adddup2(&actions, out_fd, out_target);
+  }
+
+  // Exec the cached path directly instead of letting posix_spawnp try every PATH directory
+  const string *path = SmallShell::getInstance().getPathCache().resolve(argv[0]);
+  pid_t pid;
+  int error = path ? posix_spawn(&pid, path->c_str(), &actions, &attr, argv.data(), environ)
+                   : posix_spawnp(&pid, argv[0], &actions, &attr, argv.data(), environ);
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attr);
+  if (error != 0) {
+    errno = error;
+    perror("smash error: execvp failed");
+    return -1;
+  }
+  return pid;
+}
+
+/**
+ * @brief Replaces the current process with the command's argv.
+ * 
+ * Used by forked children: commands with a policy, and nothing else spawns
+ * through here unless a subclass overrides it.
+ * 
+ * @param None.
+ * @return Never returns.
+ */
+void ExternalCommand::execChild() {
+  vector<char *> argv;
+  string storage;
+  buildArgv(argv, storage);
+  if (!argv.empty() && argv[0] != nullptr) {
+    const string *path = SmallShell::getInstance().getPathCache().resolve(argv[0]);
+    if (path != nullptr) {
+      execve(path->c_str(), argv.data(), environ);
     } else {
-      // Background execution: Add the job to the jobs list
-      jobs.addJob(cmd_line_unedited, pid);
+      execvp(argv[0], argv.data());
     }
   }
+  perror("smash error: execvp failed");
+  exit(1);
 }
 
 /**
- * @brief Executes a complex external command using `/bin/bash`.
+ * @brief Builds the argv of the external command.
  * 
- * This function forks a child process to execute the command via `/bin/bash -c`.
- * For foreground commands, the parent process waits for the child to finish.
- * For background commands, the child process is added to the jobs list.
+ * The argv array was already built from the args arena by the Command constructor,
+ * so the command line is not parsed again.
  * 
- * @param None (uses the command-line arguments stored in the `cmd_line` member).
- * @return None (outputs errors to standard error if applicable).
+ * @param argv Receives the NULL-terminated argument vector.
+ * @param storage Unused (unnamed): argv points into the args arena.
+ * @return None.
  */
-void ComplexExternalCommand::execute() {
-  pid_t pid = fork();
-  if (pid < 0) {
-    perror("smash error: fork failed");
-    return;
+void SimpleExternalCommand::buildArgv(vector<char *> &argv, string &) const {
+  for (char *const *arg = args.argv(); ; ++arg) {
+    argv.push_back(*arg);
+    if (*arg == nullptr) {
+      break;
+    }
   }
+}
 
-  if (pid == 0) {
-    // Child process
-    setpgrp();
+/**
+ * @brief Builds the argv `/bin/bash -c <command>`.
+ * 
+ * @param argv Receives the NULL-terminated argument vector.
+ * @param storage Holds the command line that argv points into.
+ * @return None.
+ */
+void ComplexExternalCommand::buildArgv(vector<char *> &argv, string &storage) const {
+  storage = cmd_line;
+  if (is_background) {
+    _removeBackgroundSign(&storage[0]);
+    storage = storage.c_str();
+  }
+  argv.push_back(const_cast<char *>("/bin/bash"));
+  argv.push_back(const_cast<char *>("-c"));
+  argv.push_back(&storage[0]);
+  argv.push_back(nullptr);
+}
 
-    string cmd_line_copy = cmd_line;
-    if (is_background) {
-      _removeBackgroundSign(&cmd_line_copy[0]);
+// Matches c against the bracket class starting at pattern ("[...]"). Sets next to the
+// character after the class. A '[' without a closing ']' only matches itself.
+static bool _globMatchClass(const char *pattern, char c, const char *&next) {
+  const char *p = pattern + 1;
+  bool negate = (*p == '!' || *p == '^');
+  if (negate) {
+    ++p;
+  }
+  bool matched = false;
+  bool first = true;
+  while (*p != '\0' && (*p != ']' || first)) {
+    first = false;
+    if (p[1] == '-' && p[2] != '\0' && p[2] != ']') {
+      matched = matched || (c >= p[0] && c <= p[2]);
+      p += 3;
+    } else {
+      matched = matched || (c == *p);
+      ++p;
     }
+  }
+  if (*p != ']') {
+    next = pattern + 1;
+    return c == '[';
+  }
+  next = p + 1;
+  return matched != negate;
+}
 
-    const char *args[] = {"/bin/bash", "-c", cmd_line_copy.c_str(), nullptr};
-    if (execvp(args[0], const_cast<char *const *>(args)) == -1) {
-      perror("smash error: execvp failed");
-      return;
+// Matches a file name against one path component of a glob: *, ? and [...] classes
+static bool _globMatch(const char *pattern, const char *name) {
+  const char *star_pattern = nullptr;
+  const char *star_name = nullptr;
+  while (*name != '\0') {
+    if (*pattern == '*') {
+      star_pattern = ++pattern;
+      star_name = name;
+      continue;
     }
-  } else {
-    // Parent process
-    SmallShell &smash = SmallShell::getInstance();
-
-    if (!is_background) {
-      // Foreground execution: Wait for the child process to finish
-      smash.setForegroundPid(pid);
-      int status;
-      if (waitpid(pid, &status, WUNTRACED) == -1) {
-        perror("smash error: waitpid failed");
-      }
-      smash.clearForegroundPid(); // Clear the foreground PID after the process finishes
+    const char *next = pattern + 1;
+    bool matched;
+    if (*pattern == '?') {
+      matched = true;
+    } else if (*pattern == '[') {
+      matched = _globMatchClass(pattern, *name, next);
+    } else {
+      matched = (*pattern != '\0' && *pattern == *name);
+    }
+    if (matched) {
+      pattern = next;
+      ++name;
+    } else if (star_pattern != nullptr) {
+      // Let the last * absorb one more character and retry
+      pattern = star_pattern;
+      name = ++star_name;
     } else {
-      // Background execution: Add the job to the jobs list
-      jobs.addJob(cmd_line_unedited, pid);
+      return false;
     }
   }
+  while (*pattern == '*') {
+    ++pattern;
+  }
+  return *pattern == '\0';
 }
 
+static bool _hasGlobChars(const string &word) {
+  return word.find_first_of("*?[") != string::npos;
+}
 
-/*******************************************************
- *              SPECIAL COMMANDS IMPLEMENTATION        *
- *******************************************************/
+// A directory entry as returned by getdents64
+struct _GlobEntry {
+  string name;
+  bool is_dir;  // Also true for a symlink to a directory
+  bool is_link;
+};
+
+static string _globJoin(const string &base, const string &name) {
+  if (base.empty()) {
+    return name;
+  }
+  return base[base.size() - 1] == '/' ? base + name : base + "/" + name;
+}
+
+// Lists a directory with getdents64, without "." and "..". Returns false if it cannot be opened.
+static bool _globListDir(const string &dir, vector<_GlobEntry> &entries) {
+  int dir_fd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd == -1) {
+    return false;
+  }
+  char buffer[32768];
+  long bytes_read;
+  while ((bytes_read = syscall(SYS_getdents64, dir_fd, buffer, sizeof(buffer))) > 0) {
+    for (long offset = 0; offset < bytes_read;) {
+      struct linux_dirent64 *d_entry = (struct linux_dirent64 *)(buffer + offset);
+      offset += d_entry->d_reclen;
+      if (strcmp(d_entry->d_name, ".") == 0 || strcmp(d_entry->d_name, "..") == 0) {
+        continue;
+      }
+      _GlobEntry entry;
+      entry.name = d_entry->d_name;
+      entry.is_dir = (d_entry->d_type == DT_DIR);
+      entry.is_link = (d_entry->d_type == DT_LNK);
+      if (d_entry->d_type == DT_UNKNOWN || d_entry->d_type == DT_LNK) {
+        struct stat st;
+        string path = _globJoin(dir, entry.name);
+        if (lstat(path.c_str(), &st) == 0) {
+          entry.is_link = S_ISLNK(st.st_mode);
+          entry.is_dir = S_ISDIR(st.st_mode) || (entry.is_link && stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode));
+        }
+      }
+      entries.push_back(entry);
+    }
+  }
+  close(dir_fd);
+  return true;
+}
 
 /**
- * @brief Executes a redirection command, redirecting the output of a command to a file.
+ * @brief Expands the glob components parts[index..] under the directory base.
  * 
- * This function handles both overwrite (>) and append (>>) redirection modes. It parses
- * the command line to extract the command to run and the target output file, then redirects
- * the standard output to the specified file. After execution, it restores the original
- * standard output.
+ * A "**" component matches any number of directories (including none), and as the
+ * last component every file and directory below base. Wildcards do not match a
+ * leading '.' unless the component starts with one, and ** does not descend into
+ * hidden directories or symlinks.
+ * 
+ * @param base The path matched so far ("" for the working directory).
+ * @param parts The components of the pattern.
+ * @param index The first component to match.
+ * @param out Receives the matching paths.
+ * @return None.
+ */
+static void _globExpand(const string &base, const vector<string> &parts, size_t index, vector<string> &out) {
+  if (index == parts.size()) {
+    struct stat st;
+    if (!base.empty() && lstat(base.c_str(), &st) == 0) {
+      out.push_back(base);
+    }
+    return;
+  }
+  const string &part = parts[index];
+  bool is_last = (index + 1 == parts.size());
+  if (!_hasGlobChars(part)) {
+    _globExpand(_globJoin(base, part), parts, index + 1, out);
+    return;
+  }
+
+  vector<_GlobEntry> entries;
+  if (!_globListDir(base, entries)) {
+    return;
+  }
+  if (part == "**") {
+    if (!is_last) {
+      _globExpand(base, parts, index + 1, out); // ** matching no directory
+    }
+    for (const _GlobEntry &entry : entries) {
+      if (entry.name[0] == '.') {
+        continue;
+      }
+      string path = _globJoin(base, entry.name);
+      if (is_last) {
+        out.push_back(path);
+      }
+      if (entry.is_dir && !entry.is_link) {
+        _globExpand(path, parts, index, out);
+      }
+    }
+    return;
+  }
+  for (const _GlobEntry &entry : entries) {
+    if ((entry.name[0] == '.' && part[0] != '.') || !_globMatch(part.c_str(), entry.name.c_str())) {
+      continue;
+    }
+    if (!is_last && !entry.is_dir) {
+      continue;
+    }
+    _globExpand(_globJoin(base, entry.name), parts, index + 1, out);
+  }
+}
+
+/**
+ * @brief Builds the argv with every wildcard argument replaced by the sorted paths it matches.
+ * 
+ * An argument that matches nothing is passed as is, as bash does by default. A
+ * pattern ending in '/' matches directories only (and symlinks to them), each
+ * kept with its trailing '/'.
+ * 
+ * @param argv Receives the NULL-terminated argument vector.
+ * @param storage Holds the expanded arguments that argv points into.
+ * @return None.
+ */
+void GlobExternalCommand::buildArgv(vector<char *> &argv, string &storage) const {
+  storage.clear();
+  size_t count = 0;
+  for (const ArgView &arg : args) {
+    string word = arg;
+    vector<string> matches;
+    if (word.find_first_of("*?") != string::npos) {
+      vector<string> parts;
+      size_t start = 0;
+      while (start <= word.size()) {
+        size_t slash = word.find('/', start);
+        if (slash == string::npos) {
+          slash = word.size();
+        }
+        if (slash > start) {
+          parts.push_back(word.substr(start, slash - start));
+        }
+        start = slash + 1;
+      }
+      _globExpand(word[0] == '/' ? "/" : "", parts, 0, matches);
+      if (word[word.size() - 1] == '/') {
+        // A trailing slash matches only directories (or symlinks to them) and is kept
+        size_t kept = 0;
+        for (const string &match : matches) {
+          struct stat st;
+          if (stat(match.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+            matches[kept++] = match + "/";
+          }
+        }
+        matches.resize(kept);
+      }
+      sort(matches.begin(), matches.end());
+    }
+    if (matches.empty()) {
+      matches.push_back(word);
+    }
+    for (const string &match : matches) {
+      storage.append(match.c_str(), match.size() + 1);
+      ++count;
+    }
+  }
+  // storage is complete, so pointers into it stay valid
+  for (size_t offset = 0; count > 0; --count) {
+    argv.push_back(&storage[offset]);
+    offset += strlen(&storage[offset]) + 1;
+  }
+  argv.push_back(nullptr);
+}
+
+// ioprio_set(2) constants; glibc does not export them
+#define IOPRIO_CLASS_SHIFT (13)
+#define IOPRIO_CLASS_RT (1)
+#define IOPRIO_CLASS_BE (2)
+#define IOPRIO_CLASS_IDLE (3)
+#define IOPRIO_WHO_PROCESS (1)
+
+// Parses a CPU list such as "0-3,6" into a cpu set
+static bool _parseCpuList(const string &list, cpu_set_t &cpus) {
+  CPU_ZERO(&cpus);
+  stringstream ss(list);
+  string range;
+  while (getline(ss, range, ',')) {
+    char *end;
+    long first = strtol(range.c_str(), &end, 10);
+    long last = first;
+    if (end == range.c_str()) {
+      return false;
+    }
+    if (*end == '-') {
+      const char *last_str = end + 1;
+      last = strtol(last_str, &end, 10);
+      if (end == last_str) {
+        return false;
+      }
+    }
+    if (*end != '\0' || first < 0 || last < first || last >= CPU_SETSIZE) {
+      return false;
+    }
+    for (long cpu = first; cpu <= last; ++cpu) {
+      CPU_SET(cpu, &cpus);
+    }
+  }
+  return CPU_COUNT(&cpus) > 0;
+}
+
+// Parses a byte count with an optional K/M/G/T suffix (powers of 1024), or "unlimited"
+static bool _parseSize(const string &value, rlim_t &size) {
+  if (value == "unlimited") {
+    size = RLIM_INFINITY;
+    return true;
+  }
+  char *end;
+  unsigned long long number = strtoull(value.c_str(), &end, 10);
+  if (end == value.c_str() || value[0] == '-') {
+    return false;
+  }
+  int shift = 0;
+  switch (toupper(static_cast<unsigned char>(*end))) {
+    case '\0': break;
+    case 'K': shift = 10; break;
+    case 'M': shift = 20; break;
+    case 'G': shift = 30; break;
+    case 'T': shift = 40; break;
+    default: return false;
+  }
+  if (*end != '\0' && end[1] != '\0') {
+    return false;
+  }
+  size = static_cast<rlim_t>(number) << shift;
+  return true;
+}
+
+// Parses a whole decimal integer in [min, max]
+static bool _parseIntInRange(const string &value, int min, int max, int &result) {
+  char *end;
+  long number = strtol(value.c_str(), &end, 10);
+  if (end == value.c_str() || *end != '\0' || number < min || number > max) {
+    return false;
+  }
+  result = static_cast<int>(number);
+  return true;
+}
+
+bool JobPolicy::parseOption(const string &name, const string &value) {
+  if (name == "cpus") {
+    hasCpus = _parseCpuList(value, cpus);
+    if (!hasCpus) {
+      return false;
+    }
+  } else if (name == "nice") {
+    hasNice = _parseIntInRange(value, -20, 19, nice);
+    if (!hasNice) {
+      return false;
+    }
+  } else if (name == "ioprio") {
+    // idle, or be/rt with an optional level 0-7 (e.g. be:4)
+    string io_class = value.substr(0, value.find(':'));
+    int level = 4;
+    if (value.find(':') != string::npos &&
+        !_parseIntInRange(value.substr(value.find(':') + 1), 0, 7, level)) {
+      return false;
+    }
+    if (io_class == "idle" && value == "idle") {
+      ioprio = IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT;
+    } else if (io_class == "be") {
+      ioprio = (IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT) | level;
+    } else if (io_class == "rt") {
+      ioprio = (IOPRIO_CLASS_RT << IOPRIO_CLASS_SHIFT) | level;
+    } else {
+      return false;
+    }
+    hasIoprio = true;
+  } else if (name == "rlimit-as") {
+    hasRlimitAs = _parseSize(value, rlimitAs);
+    if (!hasRlimitAs) {
+      return false;
+    }
+  } else if (name == "oom-score") {
+    hasOomScore = _parseIntInRange(value, -1000, 1000, oomScore);
+    if (!hasOomScore) {
+      return false;
+    }
+  } else {
+    return false;
+  }
+  description += (description.empty() ? "" : " ") + name + "=" + value;
+  return true;
+}
+
+/**
+ * @brief Applies the policy to the calling process (a forked job, before exec).
+ * 
+ * @param None.
+ * @return None. Exits the process with status 1 if a setting fails.
+ */
+void JobPolicy::apply() const {
+  if (hasCpus && sched_setaffinity(0, sizeof(cpus), &cpus) == -1) {
+    perror("smash error: sched_setaffinity failed");
+    exit(1);
+  }
+  if (hasNice && setpriority(PRIO_PROCESS, 0, nice) == -1) {
+    perror("smash error: setpriority failed");
+    exit(1);
+  }
+  if (hasIoprio && syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, ioprio) == -1) {
+    perror("smash error: ioprio_set failed");
+    exit(1);
+  }
+  if (hasRlimitAs) {
+    struct rlimit limit;
+    limit.rlim_cur = rlimitAs;
+    limit.rlim_max = rlimitAs;
+    if (setrlimit(RLIMIT_AS, &limit) == -1) {
+      perror("smash error: setrlimit failed");
+      exit(1);
+    }
+  }
+  if (hasOomScore) {
+    int fd = open("/proc/self/oom_score_adj", O_WRONLY | O_CLOEXEC);
+    string score = to_string(oomScore);
+    if (fd == -1 || write(fd, score.c_str(), score.size()) == -1) {
+      perror("smash error: oom_score_adj failed");
+      exit(1);
+    }
+    close(fd);
+  }
+}
+
+// Returns the rest of line after its first n words
+static const char *_skipWords(const char *line, size_t n) {
+  for (; n > 0; --n) {
+    line += strspn(line, WHITESPACE.c_str());
+    line += strcspn(line, WHITESPACE.c_str());
+  }
+  return line + strspn(line, WHITESPACE.c_str());
+}
+
+/**
+ * @brief Constructs a RunCommand by parsing its policy options and building the command after them.
+ * 
+ * @param cmd_line The command line, starting with "run".
+ * @param jobs The jobs list the command's job is added to.
+ */
+RunCommand::RunCommand(const char *cmd_line, JobsList &jobs) : ExternalCommand(cmd_line, jobs), valid(false) {
+  size_t i = 1;
+  while (i < args.size() && args[i].size() > 2 && args[i][0] == '-' && args[i][1] == '-') {
+    if (i + 1 >= args.size() || !policy.parseOption(args[i].substr(2), args[i + 1])) {
+      return;
+    }
+    i += 2;
+  }
+  if (i == args.size()) {
+    return;
+  }
+  // The rest of the line keeps its background sign, so the inner command matches this one
+  command.reset(SmallShell::getInstance().CreateCommand(_skipWords(this->cmd_line.c_str(), i)));
+  valid = true;
+}
+
+/**
+ * @brief Executes the RunCommand: runs its command as an external command with the policy applied.
+ * 
+ * @param None (uses the command-line arguments stored in the `args` member).
+ * @return None (outputs error messages to standard error if applicable).
+ */
+void RunCommand::execute() {
+  if (!valid) {
+    cerr << "smash error: run: invalid arguments" << endl;
+    return;
+  }
+  if (dynamic_cast<ExternalCommand *>(command.get()) == nullptr) {
+    cerr << "smash error: run: " << command->getArgs()[0] << " is not an external command" << endl;
+    return;
+  }
+  ExternalCommand::execute();
+}
+
+/**
+ * @brief Builds the argv of the wrapped command.
+ * 
+ * @param argv Receives the NULL-terminated argument vector (left empty if invalid).
+ * @param storage Holds any strings argv points into.
+ * @return None.
+ */
+void RunCommand::buildArgv(vector<char *> &argv, string &storage) const {
+  ExternalCommand *external = dynamic_cast<ExternalCommand *>(command.get());
+  if (!valid || external == nullptr) {
+    cerr << "smash error: run: invalid arguments" << endl;
+    return;
+  }
+  external->buildArgv(argv, storage);
+}
+
+/**
+ * @brief Applies the policy to the forked child and replaces it with the command.
+ * 
+ * @param None.
+ * @return Never returns.
+ */
+void RunCommand::execChild() {
+  if (!valid || dynamic_cast<ExternalCommand *>(command.get()) == nullptr) {
+    cerr << "smash error: run: invalid arguments" << endl;
+    exit(1);
+  }
+  policy.apply();
+  ExternalCommand::execChild();
+}
+
+
+/*******************************************************
+ *              SPECIAL COMMANDS IMPLEMENTATION        *
+ *******************************************************/
+
+/**
+ * @brief Executes a redirection command, redirecting the output of a command to a file.
+ * 
+ * This function handles both overwrite (>) and append (>>) redirection modes. It parses
+ * the command line to extract the command to run and the target output file, then redirects
+ * the standard output to the specified file. After execution, it restores the original
+ * standard output.
  * 
  * @note The function assumes the command line is properly formatted for redirection.
  */
@@ -1252,6 +3319,30 @@ void RedirectionCommand::execute() {
     return;
   }
 
+  int flags = O_CREAT | O_WRONLY;
+  flags |= (append_mode) ? O_APPEND : O_TRUNC;
+  SmallShell &smash = SmallShell::getInstance();
+
+  // An external command gets the file as its stdout directly (a spawn file
+  // action), so the shell's own stdout is left alone
+  Command *cmd = smash.CreateCommand(command_to_run.c_str());
+  ExternalCommand *external = dynamic_cast<ExternalCommand *>(cmd);
+  if (external != nullptr) {
+    int file_fd = open(output_file.c_str(), flags | O_CLOEXEC, 0666);
+    if (file_fd == -1) {
+      perror("smash error: open failed");
+    } else {
+      external->redirectStdout(file_fd);
+      external->execute();
+      if (close(file_fd) == -1) {
+        perror("smash error: close failed");
+      }
+    }
+    delete cmd;
+    return;
+  }
+  delete cmd;
+
   // Backup the original stdout file descriptor
   int original_stdout_fd = dup(STDOUT_FILENO);
   if (original_stdout_fd == -1) {
@@ -1260,8 +3351,6 @@ void RedirectionCommand::execute() {
   }
 
   // Open the target output file
-  int flags = O_CREAT | O_WRONLY;
-  flags |= (append_mode) ? O_APPEND : O_TRUNC;
   int file_fd = open(output_file.c_str(), flags, 0666);
   if (file_fd == -1) {
     perror("smash error: open failed");
@@ -1271,182 +3360,1077 @@ void RedirectionCommand::execute() {
     return;
   }
 
-  // Redirect stdout to the target file
-  if (dup2(file_fd, STDOUT_FILENO) == -1) {
-    perror("smash error: dup2 failed");
-    if (close(original_stdout_fd) == -1) {
-      perror("smash error: close failed");
-    }
-    if (close(file_fd) == -1) {
-      perror("smash error: close failed");
+  // Redirect stdout to the target file
+  if (dup2(file_fd, STDOUT_FILENO) == -1) {
+    perror("smash error: dup2 failed");
+    if (close(original_stdout_fd) == -1) {
+      perror("smash error: close failed");
+    }
+    if (close(file_fd) == -1) {
+      perror("smash error: close failed");
+    }
+    return;
+  }
+
+  // Close the file descriptor for the target file
+  if (close(file_fd) == -1) {
+    perror("smash error: close failed");
+    if (dup2(original_stdout_fd, STDOUT_FILENO) == -1) {  // Restore original stdout
+      perror("smash error: dup2 failed");
+    }
+    if (close(original_stdout_fd) == -1) {
+      perror("smash error: close failed");
+    }
+    return;
+  }
+
+  // Execute the command
+  fflush(stdout);
+  smash.executeCommand(command_to_run.c_str());
+  fflush(stdout); // Ensure all buffered output is written to the file
+
+  // Restore the original stdout
+  if (dup2(original_stdout_fd, STDOUT_FILENO) == -1) {
+    perror("smash error: dup2 failed");
+    if (close(original_stdout_fd) == -1) {
+      perror("smash error: close failed");
+    }
+    return;
+  }
+
+  // Close the backup file descriptor
+  if (close(original_stdout_fd) == -1) {
+    perror("smash error: close failed");
+  }
+}
+
+/**
+ * @brief Starts one stage of a pipeline without waiting for it.
+ * 
+ * External stages are spawned with their pipe ends as file actions. Built-in stages
+ * fork and run in place; since they do not exec, the child closes the O_CLOEXEC pipe
+ * ends listed in child_close itself.
+ * 
+ * @param stage The stage's command line.
+ * @param pgid The pipeline's process group, or 0 for a new group led by this stage.
+ * @param in_fd If not -1, becomes the stage's stdin.
+ * @param out_fd If not -1, becomes the stage's out_target.
+ * @param out_target STDOUT_FILENO or STDERR_FILENO.
+ * @param child_close Other pipe ends a built-in stage child must close.
+ * @param fork_failed Set to true if a built-in stage could not be forked.
+ * @return The stage's PID, or -1 if it did not start.
+ */
+static pid_t _startPipelineStage(const string &stage, pid_t pgid, int in_fd, int out_fd, int out_target,
+                                 const vector<int> &child_close, bool &fork_failed) {
+  SmallShell &smash = SmallShell::getInstance();
+  Command *cmd = smash.CreateCommand(stage.c_str());
+  ExternalCommand *external = dynamic_cast<ExternalCommand *>(cmd);
+  pid_t pid;
+  if (external != nullptr) {
+    // A stage that fails to start is skipped; its neighbours see EOF or EPIPE
+    pid = external->spawn(pgid, in_fd, out_fd, out_target);
+  } else {
+    pid = fork();
+    if (pid == -1) {
+      perror("smash error: fork failed");
+      fork_failed = true;
+    } else if (pid == 0) {
+      // Built-in stage child: join the pipeline's process group, wire up its fds and run in place
+      setpgid(0, pgid);
+      if ((in_fd != -1 && dup2(in_fd, STDIN_FILENO) == -1) ||
+          (out_fd != -1 && dup2(out_fd, out_target) == -1)) {
+        perror("smash error: dup2 failed");
+        exit(1);
+      }
+      if (in_fd != -1) {
+        close(in_fd);
+      }
+      if (out_fd != -1) {
+        close(out_fd);
+      }
+      for (int fd : child_close) {
+        close(fd);
+      }
+      cmd->execute();
+      exit(0);
+    } else {
+      // Parent: mirror the child's setpgid to avoid racing with the next stage
+      setpgid(pid, pgid == 0 ? pid : pgid);
+    }
+  }
+  delete cmd;
+  return pid;
+}
+
+/**
+ * @brief Executes a pipeline of any number of stages connected with | or |&.
+ * 
+ * Each stage runs in its own child with its stdin wired to the previous pipe and its
+ * stdout (or stderr, for a stage followed by |&) to the next one. External stages are
+ * spawned with the pipe ends as file actions; built-in stages fork and run in place.
+ * All stages share the process group of the first stage, and the parent reaps them in a
+ * single wait loop.
+ * 
+ * @note The function assumes the command line is properly formatted for a pipe operation.
+ */
+void PipeCommand::execute() {
+  string cmd_line_copy = cmd_line;
+  _removeBackgroundSign(&cmd_line_copy[0]);
+  cmd_line_copy = cmd_line_copy.c_str();
+
+  // Split the command line into stages. error_mode[i] is true if stage i is followed by |&
+  vector<string> stages;
+  vector<bool> error_mode;
+  size_t stage_start = 0;
+  while (true) {
+    size_t pipe_pos = cmd_line_copy.find('|', stage_start);
+    stages.push_back(_trim(cmd_line_copy.substr(stage_start, pipe_pos - stage_start)));
+    if (pipe_pos == string::npos) {
+      error_mode.push_back(false);
+      break;
+    }
+    bool to_stderr = (pipe_pos + 1 < cmd_line_copy.size() && cmd_line_copy[pipe_pos + 1] == '&');
+    error_mode.push_back(to_stderr);
+    stage_start = pipe_pos + (to_stderr ? 2 : 1);
+  }
+
+  // Validate parsed commands
+  for (const string &stage : stages) {
+    if (stage.empty()) {
+      cerr << "smash error: pipe: invalid format" << endl;
+      return;
+    }
+  }
+
+  SmallShell &smash = SmallShell::getInstance();
+  pid_t pgid = 0;
+  size_t started = 0;
+  int prev_read_fd = -1;
+
+  bool failed = false;
+
+  for (size_t i = 0; i < stages.size(); ++i) {
+    bool is_last = (i + 1 == stages.size());
+    int pipe_fd[2] = {-1, -1};
+    if (!is_last && pipe2(pipe_fd, O_CLOEXEC) == -1) {
+      perror("smash error: pipe failed");
+      failed = true;
+      break;
+    }
+    int target_fd = error_mode[i] ? STDERR_FILENO : STDOUT_FILENO;
+
+    vector<int> child_close;
+    if (!is_last) {
+      child_close.push_back(pipe_fd[0]);
+    }
+    bool fork_failed = false;
+    pid_t pid = _startPipelineStage(stages[i], pgid, prev_read_fd, pipe_fd[1], target_fd, child_close, fork_failed);
+    if (fork_failed) {
+      if (!is_last) {
+        close(pipe_fd[0]);
+        close(pipe_fd[1]);
+      }
+      failed = true;
+      break;
+    }
+
+    if (pid != -1) {
+      if (pgid == 0) {
+        pgid = pid;
+      }
+      ++started;
+    }
+
+    if (prev_read_fd != -1 && close(prev_read_fd) == -1) {
+      perror("smash error: close failed");
+    }
+    prev_read_fd = -1;
+    if (!is_last) {
+      if (close(pipe_fd[1]) == -1) {
+        perror("smash error: close failed");
+      }
+      prev_read_fd = pipe_fd[0];
+    }
+  }
+
+  if (prev_read_fd != -1 && close(prev_read_fd) == -1) {
+    perror("smash error: close failed");
+  }
+
+  if (started == 0) {
+    return;
+  }
+  if (failed) {
+    // The pipeline could not be built: tear down the part of it that did start
+    kill(-pgid, SIGKILL);
+  }
+
+  // Reap every stage of the pipeline in one loop. If ctrl-Z stops the
+  // pipeline, it becomes a stopped job led by its first stage.
+  smash.setForegroundPid(pgid);
+  while (started > 0) {
+    int status;
+    if (waitpid(-pgid, &status, WUNTRACED) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("smash error: waitpid failed");
+      break;
+    }
+    if (WIFSTOPPED(status)) {
+      JobsList &jobs = smash.getJobsList();
+      jobs.removeFinishedJobs(); // See JobsList::addJob
+      jobs.addJob(cmd_line_unedited, pgid, true);
+      break;
+    }
+    --started;
+  }
+  smash.clearForegroundPid();
+}
+
+// Waits until fd is ready for events. The shell relays a fan-out's data, so
+// the fan-out cannot be stopped: a ctrl-Z that stops one of its stages is
+// undone. The stop may land after the signal interrupted poll, so the stages
+// are also checked periodically. Returns the poll revents, or 0 if poll failed.
+static short _fanOutWait(int fd, short events, pid_t pgid) {
+  struct pollfd pfd;
+  pfd.fd = fd;
+  pfd.events = events;
+  while (true) {
+    pfd.revents = 0;
+    int ready = poll(&pfd, 1, 200);
+    if (ready > 0) {
+      return pfd.revents;
+    }
+    if (ready == -1 && errno != EINTR) {
+      perror("smash error: poll failed");
+      return 0;
+    }
+    siginfo_t info;
+    info.si_pid = 0;
+    if (waitid(P_PGID, pgid, &info, WSTOPPED | WNOHANG | WNOWAIT) == 0 && info.si_pid != 0) {
+      kill(-pgid, SIGCONT);
+      cerr << "smash error: fan-out: cannot be stopped" << endl;
+    }
+  }
+}
+
+// Closes a branch whose consumer went away
+static void _fanOutCloseBranch(int &fd) {
+  if (close(fd) == -1) {
+    perror("smash error: close failed");
+  }
+  fd = -1;
+}
+
+// Writes len bytes to a (non-blocking) branch, waiting for the consumer to make room
+static void _fanOutWrite(int &fd, const char *data, size_t len, pid_t pgid, long long &count) {
+  while (len > 0 && fd != -1) {
+    ssize_t written = write(fd, data, len);
+    if (written > 0) {
+      data += written;
+      len -= written;
+      count += written;
+    } else if (written == -1 && errno == EAGAIN) {
+      short revents = _fanOutWait(fd, POLLOUT, pgid);
+      if (revents == 0 || (revents & POLLERR)) {
+        _fanOutCloseBranch(fd);
+      }
+    } else if (written == -1 && errno != EINTR) {
+      if (errno != EPIPE) {
+        perror("smash error: write failed");
+      }
+      _fanOutCloseBranch(fd);
+    }
+  }
+}
+
+/**
+ * @brief Copies everything the producer writes to src into every branch.
+ * 
+ * For each chunk that is ready in src (FIONREAD), all branches but the last get a
+ * copy with tee(2) and the last one takes the data with splice(2), so the data never
+ * leaves the kernel. The writes wait for room in each branch, so the producer runs
+ * at the pace of the slowest consumer. If a branch has room for only part of a chunk
+ * (tee cannot continue from an offset), that chunk is finished with read/write.
+ * A branch whose consumer exits is dropped; the rest carry on.
+ * 
+ * @param src The read end of the producer's pipe (non-blocking).
+ * @param branches The write ends of the consumers' pipes (non-blocking); -1 once closed.
+ * @param counts Incremented by the number of bytes delivered to each branch.
+ * @param pgid The fan-out's process group.
+ * @return None.
+ */
+static void _fanOutPump(int src, vector<int> &branches, vector<long long> &counts, pid_t pgid) {
+  vector<char> buffer;
+  while (true) {
+    short revents = _fanOutWait(src, POLLIN, pgid);
+    int available = 0;
+    if (revents == 0 || ioctl(src, FIONREAD, &available) == -1 || available <= 0) {
+      break; // EOF: the producer closed its end
+    }
+    size_t len = available;
+
+    vector<size_t> live;
+    for (size_t i = 0; i < branches.size(); ++i) {
+      if (branches[i] != -1) {
+        live.push_back(i);
+      }
+    }
+    if (live.empty()) {
+      break; // Closing src makes the producer see EPIPE
+    }
+
+    // Duplicate the chunk into every branch but the last
+    size_t short_branch = live.size();
+    size_t short_done = 0;
+    for (size_t k = 0; k + 1 < live.size() && short_branch == live.size(); ++k) {
+      int &fd = branches[live[k]];
+      while (fd != -1) {
+        ssize_t copied = tee(src, fd, len, SPLICE_F_NONBLOCK);
+        if (copied == static_cast<ssize_t>(len)) {
+          counts[live[k]] += copied;
+          break;
+        }
+        if (copied == -1 && errno == EAGAIN) {
+          short out_events = _fanOutWait(fd, POLLOUT, pgid);
+          if (out_events == 0 || (out_events & POLLERR)) {
+            _fanOutCloseBranch(fd);
+          }
+        } else if (copied == -1 && errno == EPIPE) {
+          _fanOutCloseBranch(fd);
+        } else if (copied != -1 || errno != EINTR) {
+          // Partial tee (or tee not supported): finish this chunk in user space
+          short_branch = k;
+          short_done = (copied > 0) ? copied : 0;
+          counts[live[k]] += short_done;
+          break;
+        }
+      }
+    }
+
+    if (short_branch == live.size()) {
+      // Hand the chunk itself to the last branch
+      int &fd = branches[live.back()];
+      while (len > 0 && fd != -1) {
+        ssize_t moved = splice(src, nullptr, fd, nullptr, len, SPLICE_F_NONBLOCK | SPLICE_F_MOVE);
+        if (moved > 0) {
+          len -= moved;
+          counts[live.back()] += moved;
+        } else if (moved == -1 && errno == EAGAIN) {
+          short out_events = _fanOutWait(fd, POLLOUT, pgid);
+          if (out_events == 0 || (out_events & POLLERR)) {
+            _fanOutCloseBranch(fd);
+          }
+        } else if (moved == -1 && errno != EINTR) {
+          if (errno != EPIPE) {
+            perror("smash error: splice failed");
+          }
+          _fanOutCloseBranch(fd);
+        }
+      }
+      if (len == 0) {
+        continue;
+      }
+      // The last branch went away mid-chunk: the rest of the chunk is read and dropped
+      short_branch = live.size() - 1;
+      short_done = len;
+    }
+
+    buffer.resize(len);
+    size_t filled = 0;
+    while (filled < len) {
+      ssize_t got = read(src, buffer.data() + filled, len - filled);
+      if (got <= 0 && (got == 0 || errno != EINTR)) {
+        break; // Cannot happen: FIONREAD reported the bytes as available
+      }
+      if (got > 0) {
+        filled += got;
+      }
+    }
+    if (short_done < filled) {
+      _fanOutWrite(branches[live[short_branch]], buffer.data() + short_done, filled - short_done, pgid,
+                   counts[live[short_branch]]);
+    }
+    for (size_t k = short_branch + 1; k < live.size(); ++k) {
+      _fanOutWrite(branches[live[k]], buffer.data(), filled, pgid, counts[live[k]]);
+    }
+  }
+}
+
+/**
+ * @brief Executes a fan-out pipeline: producer |> consumer1 |> consumer2 ...
+ * 
+ * Every consumer reads its own copy of the producer's stdout. The producer writes
+ * into a pipe that the shell relays to one pipe per consumer (see _fanOutPump), so
+ * the output does not have to be staged in a file. All stages share the producer's
+ * process group. When the pipeline is done, the number of bytes each consumer
+ * received is printed.
+ * 
+ * @note The function assumes the command line is properly formatted for a fan-out.
+ */
+void FanOutCommand::execute() {
+  string cmd_line_copy = cmd_line;
+  _removeBackgroundSign(&cmd_line_copy[0]);
+  cmd_line_copy = cmd_line_copy.c_str();
+
+  // Split the command line into the producer and its consumers
+  vector<string> stages;
+  size_t stage_start = 0;
+  while (true) {
+    size_t pos = cmd_line_copy.find("|>", stage_start);
+    stages.push_back(_trim(cmd_line_copy.substr(stage_start, pos - stage_start)));
+    if (pos == string::npos) {
+      break;
+    }
+    stage_start = pos + 2;
+  }
+
+  // Validate parsed commands
+  for (const string &stage : stages) {
+    if (stage.empty()) {
+      cerr << "smash error: fan-out: invalid format" << endl;
+      return;
+    }
+  }
+
+  int src_fd[2];
+  if (pipe2(src_fd, O_CLOEXEC) == -1) {
+    perror("smash error: pipe failed");
+    return;
+  }
+
+  bool fork_failed = false;
+  vector<int> child_close(1, src_fd[0]);
+  pid_t pgid = _startPipelineStage(stages[0], 0, -1, src_fd[1], STDOUT_FILENO, child_close, fork_failed);
+  if (close(src_fd[1]) == -1) {
+    perror("smash error: close failed");
+  }
+  if (pgid == -1) {
+    close(src_fd[0]);
+    return;
+  }
+  size_t started = 1;
+
+  // One pipe per consumer, as large as the producer's pipe so that a whole chunk fits
+  int pipe_size = fcntl(src_fd[0], F_GETPIPE_SZ);
+  vector<int> branches;
+  for (size_t i = 1; i < stages.size() && !fork_failed; ++i) {
+    int branch_fd[2];
+    if (pipe2(branch_fd, O_CLOEXEC) == -1) {
+      perror("smash error: pipe failed");
+      break;
+    }
+    if (pipe_size > 0) {
+      fcntl(branch_fd[1], F_SETPIPE_SZ, pipe_size);
+    }
+    child_close.push_back(branch_fd[1]);
+    pid_t pid = _startPipelineStage(stages[i], pgid, branch_fd[0], -1, STDOUT_FILENO, child_close, fork_failed);
+    if (close(branch_fd[0]) == -1) {
+      perror("smash error: close failed");
+    }
+    if (pid == -1) {
+      _fanOutCloseBranch(branch_fd[1]);
+    } else {
+      ++started;
+      fcntl(branch_fd[1], F_SETFL, O_NONBLOCK);
+    }
+    branches.push_back(branch_fd[1]);
+  }
+  fcntl(src_fd[0], F_SETFL, O_NONBLOCK);
+
+  SmallShell &smash = SmallShell::getInstance();
+  vector<long long> counts(branches.size(), 0);
+  smash.setForegroundPid(pgid);
+  if (!fork_failed) {
+    // A consumer that exits must not kill the shell while it writes to it
+    void (*old_handler)(int) = signal(SIGPIPE, SIG_IGN);
+    _fanOutPump(src_fd[0], branches, counts, pgid);
+    signal(SIGPIPE, old_handler);
+  } else {
+    kill(-pgid, SIGKILL);
+  }
+  if (close(src_fd[0]) == -1) {
+    perror("smash error: close failed");
+  }
+  for (int &fd : branches) {
+    if (fd != -1) {
+      _fanOutCloseBranch(fd);
+    }
+  }
+
+  // The data is relayed, so the consumers finish on their own. From here on the
+  // fan-out is an ordinary process group: ctrl-Z makes it a stopped job.
+  bool stopped = false;
+  while (started > 0) {
+    int status;
+    if (waitpid(-pgid, &status, WUNTRACED) == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      perror("smash error: waitpid failed");
+      break;
+    }
+    if (WIFSTOPPED(status)) {
+      JobsList &jobs = smash.getJobsList();
+      jobs.removeFinishedJobs(); // See JobsList::addJob
+      jobs.addJob(cmd_line_unedited, pgid, true);
+      stopped = true;
+      break;
+    }
+    --started;
+  }
+  smash.clearForegroundPid();
+
+  if (!stopped) {
+    for (size_t i = 0; i < branches.size(); ++i) {
+      cout << "smash: fan-out: " << stages[i + 1] << ": " << counts[i] << " bytes" << endl;
+    }
+  }
+}
+
+// Largest accepted -j for du
+#define DU_MAX_THREADS 256
+
+// getdents64 buffer per du worker
+#define DU_DENTS_BUFFER_SIZE (256 * 1024)
+
+static long long _blocksToKb(long long blocks) {
+  return (blocks * 512LL + 1023) / 1024;
+}
+
+// Number of statx requests a du worker keeps in flight
+#define DU_URING_ENTRIES 256
+
+/*
+ * A minimal io_uring, driven with raw syscalls, that stats the entries of a
+ * directory in batches. statx is a blocking operation, so the kernel runs the
+ * requests on its io-wq workers; with many of them in flight, the round trips
+ * of a remote or high-latency file system overlap instead of adding up.
+ */
+class _StatxRing {
+  int ring_fd;
+  unsigned entries;
+  void *sq_ring;
+  void *cq_ring;
+  size_t sq_ring_size;
+  size_t cq_ring_size;
+  struct io_uring_sqe *sqes;
+  size_t sqes_size;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+
+  unsigned reap(vector<int> &errors, bool &unsupported);
+  void drain(unsigned submitted, vector<int> &errors);
+
+public:
+  _StatxRing() : ring_fd(-1), entries(0), sq_ring(MAP_FAILED), cq_ring(MAP_FAILED), sq_ring_size(0),
+                 cq_ring_size(0), sqes(static_cast<struct io_uring_sqe *>(MAP_FAILED)), sqes_size(0) {}
+  ~_StatxRing() { close(); }
+
+  _StatxRing(const _StatxRing &) = delete;
+  _StatxRing &operator=(const _StatxRing &) = delete;
+
+  // Sets up the ring; false if io_uring is not available
+  bool open(unsigned size);
+  void close();
+  bool isOpen() const { return ring_fd != -1; }
+
+  /*
+   * Stats names[i] relative to dir_fd (without following symlinks) into
+   * results[i]; errors[i] is 0 or the errno of that entry. Returns false,
+   * with the ring closed, if the kernel cannot run statx through io_uring;
+   * no request is in flight by then, so the caller may reuse the buffers.
+   */
+  bool statBatch(int dir_fd, const vector<const char *> &names, vector<struct statx> &results, vector<int> &errors);
+};
+
+bool _StatxRing::open(unsigned size) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ring_fd = syscall(__NR_io_uring_setup, size, &params);
+  if (ring_fd == -1) {
+    return false;
+  }
+  entries = params.sq_entries;
+
+  sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    sq_ring_size = cq_ring_size = max(sq_ring_size, cq_ring_size);
+  }
+  sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                 IORING_OFF_SQ_RING);
+  if (sq_ring == MAP_FAILED) {
+    close();
+    return false;
+  }
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    cq_ring = sq_ring;
+  } else {
+    cq_ring = mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                   IORING_OFF_CQ_RING);
+  }
+  sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  sqes = static_cast<struct io_uring_sqe *>(
+      mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES));
+  if (cq_ring == MAP_FAILED || sqes == MAP_FAILED) {
+    close();
+    return false;
+  }
+
+  char *sq = static_cast<char *>(sq_ring);
+  char *cq = static_cast<char *>(cq_ring);
+  sq_tail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+  sq_mask = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+  sq_array = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+  cq_head = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+  cq_tail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+  cq_mask = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+  cqes = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+  return true;
+}
+
+void _StatxRing::close() {
+  if (sqes != MAP_FAILED) {
+    munmap(sqes, sqes_size);
+    sqes = static_cast<struct io_uring_sqe *>(MAP_FAILED);
+  }
+  if (cq_ring != MAP_FAILED && cq_ring != sq_ring) {
+    munmap(cq_ring, cq_ring_size);
+  }
+  cq_ring = MAP_FAILED;
+  if (sq_ring != MAP_FAILED) {
+    munmap(sq_ring, sq_ring_size);
+    sq_ring = MAP_FAILED;
+  }
+  if (ring_fd != -1) {
+    ::close(ring_fd);
+    ring_fd = -1;
+  }
+}
+
+// Consumes the available completions into errors; returns how many there were
+unsigned _StatxRing::reap(vector<int> &errors, bool &unsupported) {
+  unsigned head = *cq_head;
+  unsigned ready = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+  unsigned count = ready - head;
+  for (; head != ready; ++head) {
+    struct io_uring_cqe *cqe = &cqes[head & *cq_mask];
+    if (cqe->res == -EINVAL) {
+      // The kernel does not know IORING_OP_STATX: stop submitting and fall
+      // back once the requests in flight are done
+      unsupported = true;
     }
-    return;
+    errors[cqe->user_data] = (cqe->res < 0) ? -cqe->res : 0;
   }
+  __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+  return count;
+}
 
-  // Close the file descriptor for the target file
-  if (close(file_fd) == -1) {
-    perror("smash error: close failed");
-    if (dup2(original_stdout_fd, STDOUT_FILENO) == -1) {  // Restore original stdout
-      perror("smash error: dup2 failed");
-    }
-    if (close(original_stdout_fd) == -1) {
-      perror("smash error: close failed");
+// Waits for the submitted requests to complete, so that none writes into a buffer after close
+void _StatxRing::drain(unsigned submitted, vector<int> &errors) {
+  bool unsupported = false;
+  while (submitted > 0) {
+    submitted -= reap(errors, unsupported);
+    if (submitted > 0 && syscall(__NR_io_uring_enter, ring_fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) == -1 &&
+        errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+      break; // Closing the ring cancels what is left
     }
-    return;
   }
+}
 
-  // Execute the command
-  fflush(stdout);
-  SmallShell &smash = SmallShell::getInstance();
-  smash.executeCommand(command_to_run.c_str());
-  fflush(stdout); // Ensure all buffered output is written to the file
+bool _StatxRing::statBatch(int dir_fd, const vector<const char *> &names, vector<struct statx> &results,
+                           vector<int> &errors) {
+  results.resize(names.size());
+  errors.assign(names.size(), 0);
+  size_t next = 0;
+  unsigned in_flight = 0;
+  unsigned unsubmitted = 0;
+  bool unsupported = false;
+  while ((next < names.size() && !unsupported) || in_flight > 0) {
+    // Fill the free submission slots. Only this thread touches the ring, so the
+    // tail is ours; the release store publishes the entries to the kernel.
+    unsigned tail = *sq_tail;
+    while (next < names.size() && !unsupported && in_flight < entries) {
+      unsigned index = tail & *sq_mask;
+      struct io_uring_sqe *sqe = &sqes[index];
+      memset(sqe, 0, sizeof(*sqe));
+      sqe->opcode = IORING_OP_STATX;
+      sqe->fd = dir_fd;
+      sqe->addr = reinterpret_cast<uintptr_t>(names[next]);
+      sqe->len = STATX_TYPE | STATX_BLOCKS;
+      sqe->off = reinterpret_cast<uintptr_t>(&results[next]);
+      sqe->statx_flags = AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT;
+      sqe->user_data = next;
+      sq_array[index] = index;
+      ++tail;
+      ++next;
+      ++in_flight;
+      ++unsubmitted;
+    }
+    __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+
+    long submitted = syscall(__NR_io_uring_enter, ring_fd, unsubmitted, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+    bool transient = false;
+    if (submitted >= 0) {
+      unsubmitted -= submitted;
+    } else if (errno == EAGAIN || errno == EBUSY) {
+      // Out of kernel resources, or the completion queue is full: reap and retry
+      transient = true;
+    } else if (errno != EINTR) {
+      perror("smash error: io_uring_enter failed");
+      drain(in_flight - unsubmitted, errors);
+      close();
+      return false;
+    }
 
-  // Restore the original stdout
-  if (dup2(original_stdout_fd, STDOUT_FILENO) == -1) {
-    perror("smash error: dup2 failed");
-    if (close(original_stdout_fd) == -1) {
-      perror("smash error: close failed");
+    unsigned reaped = reap(errors, unsupported);
+    in_flight -= reaped;
+    if (transient && reaped == 0 && in_flight > unsubmitted) {
+      // Nothing to make room with yet: wait for a completion instead of spinning
+      syscall(__NR_io_uring_enter, ring_fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
     }
-    return;
   }
-
-  // Close the backup file descriptor
-  if (close(original_stdout_fd) == -1) {
-    perror("smash error: close failed");
+  if (unsupported) {
+    close();
+    return false;
   }
+  return true;
 }
 
-/**
- * @brief Executes a pipe command, connecting the output of one command to the input of another.
- * 
- * This function handles both standard output (|) and standard error (|&) redirection between two commands.
- * It forks two child processes to execute the commands and uses a pipe to connect their input/output.
- * 
- * @note The function assumes the command line is properly formatted for a pipe operation.
+/*
+ * A directory being traversed by du. Each directory is one task. Its
+ * subdirectories are opened relative to its fd, so the fd is held until
+ * every subdirectory task has opened itself; pending counts those tasks
+ * plus one while the directory is being scanned. The node itself lives
+ * until its whole subtree is done (unfinished reaches 0), and then adds its
+ * total to its parent's.
  */
-void PipeCommand::execute() {
-  string command_1, command_2;
-  bool error_mode = false; // true for |& (stderr), false for | (stdout)
-  size_t pipe_pos;
+struct _DuDir {
+  _DuDir *parent;
+  string name; // Relative to the parent (the path as given for the root)
+  int fd;
+  int depth;
+  atomic<int> pending;
+  atomic<int> unfinished;
+  atomic<long long> total_kb; // Own blocks, then the subtree as it completes
+
+  _DuDir(_DuDir *parent, const char *name, long long self_kb)
+      : parent(parent), name(name), fd(-1), depth(parent ? parent->depth + 1 : 0), pending(1), unfinished(1),
+        total_kb(self_kb) {}
+};
 
-  string cmd_line_copy = cmd_line;
-  _removeBackgroundSign(&cmd_line_copy[0]);
+// Orders a min-heap of DiskUsageCommand::Listed by size
+static bool _duLargerKb(const DiskUsageCommand::Listed &a, const DiskUsageCommand::Listed &b) {
+  return a.first > b.first;
+}
 
-  // Parse the command line for pipe operators
-  if ((pipe_pos = cmd_line_copy.find("|&")) != string::npos) {
-    error_mode = true;
-    command_1 = _trim(cmd_line_copy.substr(0, pipe_pos));
-    command_2 = _trim(cmd_line_copy.substr(pipe_pos + 2));
-  } else if ((pipe_pos = cmd_line_copy.find('|')) != string::npos) {
-    error_mode = false;
-    command_1 = _trim(cmd_line_copy.substr(0, pipe_pos));
-    command_2 = _trim(cmd_line_copy.substr(pipe_pos + 1));
-  } else {
-    cerr << "smash error: pipe: invalid format" << endl;
-    return;
+/*
+ * Work-stealing traversal used by du. Every worker owns a deque of
+ * directory tasks: it pushes and pops at the back (depth first, which keeps
+ * few directories open), and idle workers steal from the front of the
+ * others' deques. Totals are added up the tree as directories complete, so
+ * every directory's subtotal is known in the same traversal; directories to
+ * list are collected per worker and merged once all workers are done.
+ *
+ * The entries of each getdents batch are stat'ed together, through the
+ * worker's io_uring when one is available and with fstatat otherwise.
+ */
+class _DuWalk {
+  struct Worker {
+    mutex lock;
+    deque<_DuDir *> tasks;
+    vector<char> buffer;
+    _StatxRing ring;
+    vector<const char *> names;
+    vector<struct statx> results;
+    vector<int> errors;
+    vector<DiskUsageCommand::Listed> listed; // Directories within the depth limit
+    vector<DiskUsageCommand::Listed> top;    // Min-heap of the largest directories seen by this worker
+  };
+
+  vector<Worker> workers;
+  bool use_uring;
+  int list_depth; // List the directories down to this depth (-1: none)
+  size_t top_n;   // Keep the top_n largest directories (0: none)
+  long long root_total_kb;
+  atomic<long> outstanding; // Tasks pushed and not yet scanned
+  atomic<long> queued;      // Tasks pushed and not yet popped
+  atomic<int> idle;         // Workers waiting (or about to wait) on idle_cv
+  mutex idle_lock;
+  condition_variable idle_cv;
+
+public:
+  _DuWalk(int threads, bool use_uring, int list_depth, size_t top_n)
+      : workers(threads), use_uring(use_uring), list_depth(list_depth), top_n(top_n), root_total_kb(0),
+        outstanding(0), queued(0), idle(0) {}
+
+  /*
+   * Returns the usage of everything below path, not including path itself.
+   * listed gets the directories within the depth limit (sorted by path) or
+   * the top_n largest directories (largest first).
+   */
+  long long run(const char *path, vector<DiskUsageCommand::Listed> &listed);
+
+private:
+  void push(size_t self, _DuDir *dir);
+  bool pop(size_t self, _DuDir *&dir);
+  void work(size_t self);
+  void scan(size_t self, _DuDir *dir);
+  bool statNames(Worker &worker, int dir_fd);
+  void finish(size_t self, _DuDir *dir);
+  static string pathOf(const _DuDir *dir);
+  static void releaseFd(_DuDir *dir);
+};
+
+long long _DuWalk::run(const char *path, vector<DiskUsageCommand::Listed> &listed) {
+  push(0, new _DuDir(nullptr, path, 0));
+
+  // The workers must not run the shell's signal handlers
+  sigset_t all, old;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  vector<thread> threads;
+  for (size_t i = 1; i < workers.size(); ++i) {
+    threads.push_back(thread(&_DuWalk::work, this, i));
   }
+  pthread_sigmask(SIG_SETMASK, &old, nullptr);
 
-  // Validate parsed commands
-  if (command_1.empty() || command_2.empty()) {
-    cerr << "smash error: pipe: invalid format" << endl;
-    return;
+  work(0);
+  for (thread &t : threads) {
+    t.join();
   }
 
-  // Create a pipe
-  int pipe_fd[2];
-  if (pipe(pipe_fd) == -1) {
-    perror("smash error: pipe failed");
-    return;
+  // Merge what the workers listed
+  listed.clear();
+  for (Worker &worker : workers) {
+    listed.insert(listed.end(), worker.listed.begin(), worker.listed.end());
+    for (const DiskUsageCommand::Listed &entry : worker.top) {
+      if (listed.size() < top_n) {
+        listed.push_back(entry);
+        push_heap(listed.begin(), listed.end(), _duLargerKb);
+      } else if (entry.first > listed.front().first) {
+        pop_heap(listed.begin(), listed.end(), _duLargerKb);
+        listed.back() = entry;
+        push_heap(listed.begin(), listed.end(), _duLargerKb);
+      }
+    }
+  }
+  if (top_n > 0) {
+    sort_heap(listed.begin(), listed.end(), _duLargerKb);
+  } else {
+    sort(listed.begin(), listed.end(), [](const DiskUsageCommand::Listed &a, const DiskUsageCommand::Listed &b) {
+      return a.second < b.second;
+    });
   }
+  return root_total_kb;
+}
 
-  SmallShell &smash = SmallShell::getInstance();
+void _DuWalk::push(size_t self, _DuDir *dir) {
+  ++outstanding;
+  {
+    lock_guard<mutex> guard(workers[self].lock);
+    workers[self].tasks.push_back(dir);
+  }
+  ++queued;
+  // A waiter announces itself before re-checking queued, so either it sees this
+  // task or it is seen here; notifying under idle_lock cannot slip in before its wait
+  if (idle > 0) {
+    lock_guard<mutex> guard(idle_lock);
+    idle_cv.notify_one();
+  }
+}
 
-  // Fork the first child process
-  pid_t pid1 = fork();
-  if (pid1 == -1) {
-    perror("smash error: fork failed");
-    if (close(pipe_fd[0]) == -1) {
-      perror("smash error: close failed");
-    }    
-    if (close(pipe_fd[1]) == -1) {
-      perror("smash error: close failed");
+bool _DuWalk::pop(size_t self, _DuDir *&dir) {
+  {
+    lock_guard<mutex> guard(workers[self].lock);
+    if (!workers[self].tasks.empty()) {
+      dir = workers[self].tasks.back();
+      workers[self].tasks.pop_back();
+      --queued;
+      return true;
+    }
+  }
+  for (size_t i = 1; i < workers.size(); ++i) {
+    Worker &victim = workers[(self + i) % workers.size()];
+    lock_guard<mutex> guard(victim.lock);
+    if (!victim.tasks.empty()) {
+      dir = victim.tasks.front();
+      victim.tasks.pop_front();
+      --queued;
+      return true;
     }
-    return;
   }
+  return false;
+}
 
-  if (pid1 == 0) {
-    // Child 1: Executes command_1
-    setpgrp();
-    int target_fd_for_cmd1_output = error_mode ? STDERR_FILENO : STDOUT_FILENO;
-    if (dup2(pipe_fd[1], target_fd_for_cmd1_output) == -1) {
-      perror("smash error: dup2 failed");
-      // Ensure pipe ends are closed before exiting
-      close(pipe_fd[0]); 
-      close(pipe_fd[1]);
-      exit(1); // Exit child process on error
+void _DuWalk::work(size_t self) {
+  workers[self].buffer.resize(DU_DENTS_BUFFER_SIZE);
+  if (use_uring) {
+    workers[self].ring.open(DU_URING_ENTRIES);
+  }
+  while (true) {
+    _DuDir *dir;
+    if (pop(self, dir)) {
+      scan(self, dir);
+      if (--outstanding == 0) {
+        lock_guard<mutex> guard(idle_lock);
+        idle_cv.notify_all();
+      }
+      continue;
     }
-    // Close unused pipe ends
-    if (close(pipe_fd[0]) == -1) {
-      perror("smash error: close failed");
-    }    
-    if (close(pipe_fd[1]) == -1) {
-      perror("smash error: close failed");
+    // Sleep until a task is queued (see push) or the walk is over
+    unique_lock<mutex> guard(idle_lock);
+    ++idle;
+    while (queued == 0 && outstanding != 0) {
+      idle_cv.wait(guard);
+    }
+    --idle;
+    if (outstanding == 0) {
+      return;
     }
-    smash.executeCommand(command_1.c_str());
-    exit(0); // Ensure child process exits after execution
   }
+}
 
-  // Fork the second child process
-  pid_t pid2 = fork();
-  if (pid2 == -1) {
-    perror("smash error: fork failed");
-    kill(pid1, SIGINT); // Clean up first child if it was successfully forked
-    waitpid(pid1, nullptr, 0);
-    if (close(pipe_fd[0]) == -1) {
-      perror("smash error: close failed");
-    }    
-    if (close(pipe_fd[1]) == -1) {
+void _DuWalk::releaseFd(_DuDir *dir) {
+  if (dir != nullptr && --dir->pending == 0 && dir->fd != -1) {
+    if (close(dir->fd) == -1) {
       perror("smash error: close failed");
     }
-    return;
+    dir->fd = -1;
   }
+}
 
-  if (pid2 == 0) {
-    // Child 2: Executes command_2
-    setpgrp();
-    if (dup2(pipe_fd[0], STDIN_FILENO) == -1) {
-      perror("smash error: dup2 failed");
-      // Ensure pipe ends are closed before exiting
-      close(pipe_fd[0]);
-      close(pipe_fd[1]);
-      exit(1); // Exit child process on error
+string _DuWalk::pathOf(const _DuDir *dir) {
+  vector<const string *> names;
+  for (; dir != nullptr; dir = dir->parent) {
+    names.push_back(&dir->name);
+  }
+  string path = *names.back();
+  for (auto it = names.rbegin() + 1; it != names.rend(); ++it) {
+    path += '/';
+    path += **it;
+  }
+  return path;
+}
+
+/**
+ * @brief Drops one reference to a directory's subtree; completes the directory on the last.
+ * 
+ * A completed directory is listed if it is within the depth limit or among the largest
+ * seen so far, adds its total to its parent's and is freed. That may complete the
+ * parent in turn. The root's total becomes the result of the walk.
+ * 
+ * @param self The calling worker.
+ * @param dir The directory.
+ * @return None.
+ */
+void _DuWalk::finish(size_t self, _DuDir *dir) {
+  Worker &worker = workers[self];
+  while (dir != nullptr && --dir->unfinished == 0) {
+    long long total_kb = dir->total_kb;
+    if (dir->depth > 0 && dir->depth <= list_depth) {
+      worker.listed.push_back(DiskUsageCommand::Listed(total_kb, pathOf(dir)));
     }
-    // Close unused pipe ends
-    if (close(pipe_fd[0]) == -1) {
-      perror("smash error: close failed");
-    }    
-    if (close(pipe_fd[1]) == -1) {
-      perror("smash error: close failed");
+    if (dir->depth > 0 && top_n > 0) {
+      if (worker.top.size() < top_n) {
+        worker.top.push_back(DiskUsageCommand::Listed(total_kb, pathOf(dir)));
+        push_heap(worker.top.begin(), worker.top.end(), _duLargerKb);
+      } else if (total_kb > worker.top.front().first) {
+        pop_heap(worker.top.begin(), worker.top.end(), _duLargerKb);
+        worker.top.back() = DiskUsageCommand::Listed(total_kb, pathOf(dir));
+        push_heap(worker.top.begin(), worker.top.end(), _duLargerKb);
+      }
+    }
+
+    _DuDir *parent = dir->parent;
+    if (parent != nullptr) {
+      parent->total_kb += total_kb;
+    } else {
+      root_total_kb = total_kb;
     }
-    smash.executeCommand(command_2.c_str());
-    exit(0); // Ensure child process exits after execution
+    delete dir;
+    dir = parent;
   }
+}
 
-  // Parent process: Close pipe and wait for both children
-  if (close(pipe_fd[0]) == -1) {
-    perror("smash error: close failed");
-  }    
-  if (close(pipe_fd[1]) == -1) {
-    perror("smash error: close failed");
+void _DuWalk::scan(size_t self, _DuDir *dir) {
+  Worker &worker = workers[self];
+  int parent_fd = (dir->parent != nullptr) ? dir->parent->fd : AT_FDCWD;
+  int fd = openat(parent_fd, dir->name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+  releaseFd(dir->parent);
+  if (fd == -1) {
+    perror("smash error: open failed");
+    finish(self, dir);
+    return;
   }
+  dir->fd = fd;
 
-  int status1, status2;
-  if (waitpid(pid1, &status1, 0) == -1) {
-    perror("smash error: waitpid failed");
+  long bytes_read;
+  while ((bytes_read = syscall(SYS_getdents64, dir->fd, worker.buffer.data(), worker.buffer.size())) > 0) {
+    worker.names.clear();
+    for (long offset = 0; offset < bytes_read;) {
+      struct linux_dirent64 *d_entry = (struct linux_dirent64 *)(worker.buffer.data() + offset);
+      offset += d_entry->d_reclen;
+      const char *name = d_entry->d_name;
+      if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+        continue;
+      }
+      worker.names.push_back(name);
+    }
+
+    bool used_statx = statNames(worker, dir->fd);
+    long long files_kb = 0;
+    for (size_t i = 0; i < worker.names.size(); ++i) {
+      if (worker.errors[i] != 0) {
+        errno = worker.errors[i];
+        perror(used_statx ? "smash error: statx failed" : "smash error: fstatat failed");
+        continue;
+      }
+      long long kb = _blocksToKb(worker.results[i].stx_blocks);
+
+      if (S_ISDIR(worker.results[i].stx_mode)) {
+        // The subdirectory's own blocks are part of its total, added when it completes
+        ++dir->pending;
+        ++dir->unfinished;
+        push(self, new _DuDir(dir, worker.names[i], kb));
+      } else {
+        files_kb += kb;
+      }
+    }
+    dir->total_kb += files_kb;
   }
-  if (waitpid(pid2, &status2, 0) == -1) {
-    perror("smash error: waitpid failed");
+  if (bytes_read == -1) {
+    perror("smash error: getdents64 failed");
   }
+  releaseFd(dir);
+  finish(self, dir);
+}
+
+// Stats worker.names relative to dir_fd into worker.results and worker.errors;
+// returns true if statx (through io_uring) was used, false for fstatat
+bool _DuWalk::statNames(Worker &worker, int dir_fd) {
+  if (worker.ring.isOpen() && worker.ring.statBatch(dir_fd, worker.names, worker.results, worker.errors)) {
+    return true;
+  }
+  worker.results.resize(worker.names.size());
+  worker.errors.assign(worker.names.size(), 0);
+  for (size_t i = 0; i < worker.names.size(); ++i) {
+    struct stat statbuf;
+    if (fstatat(dir_fd, worker.names[i], &statbuf, AT_SYMLINK_NOFOLLOW) == -1) {
+      worker.errors[i] = errno;
+      continue;
+    }
+    worker.results[i].stx_mode = statbuf.st_mode;
+    worker.results[i].stx_blocks = statbuf.st_blocks;
+  }
+  return false;
 }
 
 /**
@@ -1455,19 +4439,60 @@ void PipeCommand::execute() {
  * This function validates the input arguments, checks if the specified path is a directory,
  * and calculates the total disk usage in kilobytes. It includes the size of the directory itself
  * and all its contents (recursively). If no path is provided, it defaults to the current directory.
+ * With -j N, the traversal runs on N threads. With --uring, entries are stat'ed through
+ * io_uring (falling back to fstatat if the kernel does not support it); this pays off on
+ * network and other high-latency storage, while fstatat is faster on a local, cached tree.
+ * du --watch PATH scans PATH into the shell's DiskUsageIndex; from then on, du on any
+ * directory of that tree is answered from the index instead of walking it.
+ * du --depth D lists the total of every directory down to depth D, and du --top N lists
+ * the N largest directories; both come from the same single traversal, which also runs
+ * when they are combined with --watch (the index does not keep per-directory listings).
  * 
  * @param None (uses the command-line arguments stored in the `args` member).
  * @return None (outputs the total disk usage to standard output or error messages to standard error).
  */
 void DiskUsageCommand::execute() {
+  int threads = 1;
+  bool use_uring = false;
+  bool watch = false;
+  int list_depth = -1;
+  int top_n = 0;
+  const char *path = ".";
+  size_t paths = 0;
+  for (size_t i = 1; i < args.size(); ++i) {
+    if (args[i] == "-j" || args[i] == "--depth" || args[i] == "--top") {
+      bool valid = (i + 1 < args.size());
+      if (valid && args[i] == "-j") {
+        valid = _parseIntInRange(args[i + 1], 1, DU_MAX_THREADS, threads);
+      } else if (valid && args[i] == "--depth") {
+        valid = _parseIntInRange(args[i + 1], 0, INT_MAX, list_depth);
+      } else if (valid) {
+        valid = _parseIntInRange(args[i + 1], 1, INT_MAX, top_n);
+      }
+      if (!valid) {
+        cerr << "smash error: du: invalid arguments" << endl;
+        return;
+      }
+      ++i;
+    } else if (args[i] == "--uring") {
+      use_uring = true;
+    } else if (args[i] == "--watch") {
+      watch = true;
+    } else {
+      path = args[i].c_str();
+      ++paths;
+    }
+  }
+
   // Validate the number of arguments
-  if (args.size() > 2) {
+  if (paths > 1) {
     cerr << "smash error: du: too many arguments" << endl;
     return;
   }
-
-  // Determine the target path (default to current directory if no argument is provided)
-  const char* path = (args.size() == 1) ? "." : args[1].c_str();
+  if (list_depth >= 0 && top_n > 0) {
+    cerr << "smash error: du: invalid arguments" << endl; // One listing at a time
+    return;
+  }
 
   // Check if the specified path exists and is a directory
   struct stat statbuf;
@@ -1476,82 +4501,379 @@ void DiskUsageCommand::execute() {
     return;
   }
 
-  // Start with the size of the initial directory itself, based on its blocks
-  long long total_usage_kb = (statbuf.st_blocks * 512LL + 1023) / 1024;
+  // A listing needs a walk (also right after --watch); the index only keeps the totals current
+  DiskUsageIndex &index = SmallShell::getInstance().getDiskUsageIndex();
+  bool listing = (list_depth >= 0 || top_n > 0);
+  vector<Listed> listed;
+  long long total_usage_kb;
+  if (watch && !index.watch(path)) {
+    return;
+  }
+  if (listing || !index.lookup(path, total_usage_kb)) {
+    // Start with the size of the initial directory itself, based on its blocks
+    total_usage_kb = _blocksToKb(statbuf.st_blocks);
+
+    // Add the sum of the sizes of its contents (calculated recursively)
+    total_usage_kb += calculateDiskUsage(path, threads, use_uring, list_depth, top_n, listed);
+  }
 
-  // Add the sum of the sizes of its contents (calculated recursively)
-  total_usage_kb += calculateDiskUsage(path);
+  for (const Listed &entry : listed) {
+    cout << entry.first << " KB\t" << entry.second << endl;
+  }
 
   // Output the total disk usage
   cout << "Total disk usage: " << total_usage_kb << " KB" << endl;
 }
 
 /**
- * @brief Recursively calculates the total disk usage of a directory and its contents.
+ * @brief Calculates the total disk usage of a directory's contents.
  * 
- * This function traverses the specified directory, including its subdirectories,
- * and calculates the total disk usage in kilobytes. It uses the `SYS_getdents64` 
- * system call to read directory entries and `lstat` to retrieve file metadata.
+ * Directories are traversed as tasks of a work-stealing pool (see _DuWalk). Entries are
+ * read with `SYS_getdents64` into a large buffer and stat'ed relative to the directory's
+ * fd, a whole batch at a time through io_uring (see _StatxRing) or one by one with
+ * `fstatat`, so no paths are built.
  * 
  * @param path The path to the directory whose disk usage is to be calculated.
+ * @param threads The number of threads to traverse with (the calling thread is one of them).
+ * @param use_uring Whether to stat entries through io_uring when it is available.
+ * @param list_depth List the subdirectories down to this depth (-1 for none).
+ * @param top_n List the top_n largest subdirectories (0 for none).
+ * @param listed Receives the listed directories' totals (KB) and paths.
  * @return The total disk usage in kilobytes as a long long integer.
  */
-long long DiskUsageCommand::calculateDiskUsage(const char* path) {
-  long long total_size_kb = 0;
+long long DiskUsageCommand::calculateDiskUsage(const char* path, int threads, bool use_uring, int list_depth,
+                                               int top_n, vector<Listed> &listed) {
+  _DuWalk walk(threads, use_uring, list_depth, top_n);
+  return walk.run(path, listed);
+}
+
+// Events that change the usage of a watched directory. Writes (IN_MODIFY) are
+// coalesced: an entry is re-stat'ed once per batch of events, however many arrive
+#define DU_WATCH_MASK (IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE | IN_MOVED_FROM | \
+                       IN_MOVED_TO | IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK)
 
-  // Open the directory
-  int dir_fd = open(path, O_RDONLY | O_DIRECTORY);
+/**
+ * @brief Scans a directory of the watched tree and everything below it.
+ * 
+ * The watch is added before the entries are read, so an entry created during
+ * the scan is either read or reported by an event (possibly both: events are
+ * applied by re-reading the entry, so that is harmless).
+ * 
+ * @param parent The parent directory's node, or nullptr for the root.
+ * @param name The directory's name in its parent.
+ * @param path The directory's path; used as scratch space for the subdirectories' paths.
+ * @return The new node, or nullptr if the directory could not be read or watched.
+ */
+DiskUsageIndex::Dir *DiskUsageIndex::scan(Dir *parent, const string &name, string &path) {
+  int dir_fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
   if (dir_fd == -1) {
     perror("smash error: open failed");
-    return 0;
+    return nullptr;
+  }
+  int wd = inotify_add_watch(inotifyFd, path.c_str(), DU_WATCH_MASK);
+  struct stat statbuf;
+  if (wd == -1 || fstat(dir_fd, &statbuf) == -1) {
+    perror(wd == -1 ? "smash error: inotify_add_watch failed" : "smash error: fstat failed");
+    watchFailed = true;
+    close(dir_fd);
+    return nullptr;
   }
 
-  char buffer[4096];
-  struct linux_dirent64 *d_entry;
-  struct stat entry_statbuf;
-  int bytes_read;
-
-  // Read directory entries in batches
-  while ((bytes_read = syscall(SYS_getdents64, dir_fd, buffer, sizeof(buffer))) > 0) {
-    for (int offset = 0; offset < bytes_read;) {
-      char* entry_ptr = buffer + offset;
-      d_entry = (struct linux_dirent64*)entry_ptr;
-      string entry_name = d_entry->d_name;
-
-      // Skip "." and ".." entries
-      if (entry_name == "." || entry_name == "..") {
-        offset += d_entry->d_reclen;
+  Dir *dir = new Dir();
+  dir->parent = parent;
+  dir->name = name;
+  dir->wd = wd;
+  dir->selfKb = _blocksToKb(statbuf.st_blocks);
+  dir->totalKb = dir->selfKb;
+  byWatch[wd] = dir;
+
+  // Subdirectories are scanned once this directory is closed, so that only
+  // one directory fd and one getdents buffer are in use at a time
+  vector<string> subdir_names;
+  vector<char> buffer(DU_DENTS_BUFFER_SIZE);
+  long bytes_read;
+  while ((bytes_read = syscall(SYS_getdents64, dir_fd, buffer.data(), buffer.size())) > 0) {
+    for (long offset = 0; offset < bytes_read;) {
+      struct linux_dirent64 *d_entry = (struct linux_dirent64 *)(buffer.data() + offset);
+      offset += d_entry->d_reclen;
+      const char *entry_name = d_entry->d_name;
+      if (entry_name[0] == '.' && (entry_name[1] == '\0' || (entry_name[1] == '.' && entry_name[2] == '\0'))) {
         continue;
       }
-
-      // Construct the full path of the entry
-      string full_path = string(path) + "/" + entry_name;
-
-      // Retrieve metadata for the entry
-      if (lstat(full_path.c_str(), &entry_statbuf) == -1) {
-        perror("smash error: lstat failed");
-        offset += d_entry->d_reclen;
+      if (fstatat(dir_fd, entry_name, &statbuf, AT_SYMLINK_NOFOLLOW) == -1) {
+        if (errno != ENOENT) { // An entry removed since getdents is reported by an event
+          perror("smash error: fstatat failed");
+        }
         continue;
       }
+      if (S_ISDIR(statbuf.st_mode)) {
+        subdir_names.push_back(entry_name);
+      } else {
+        long long kb = _blocksToKb(statbuf.st_blocks);
+        dir->files[entry_name] = kb;
+        dir->totalKb += kb;
+      }
+    }
+  }
+  if (bytes_read == -1) {
+    perror("smash error: getdents64 failed");
+  }
+  if (close(dir_fd) == -1) {
+    perror("smash error: close failed");
+  }
+
+  size_t path_len = path.size();
+  for (const string &subdir_name : subdir_names) {
+    if (watchFailed) {
+      break;
+    }
+    path += '/';
+    path += subdir_name;
+    Dir *subdir = scan(dir, subdir_name, path);
+    path.resize(path_len);
+    if (subdir != nullptr) {
+      dir->subdirs[subdir_name] = subdir;
+      dir->totalKb += subdir->totalKb;
+    }
+  }
+  return dir;
+}
 
-      // Add the size of the current entry (file or directory itself)
-      total_size_kb += (entry_statbuf.st_blocks * 512LL + 1023) / 1024;
+// Deletes a directory's subtree from the index and (unless told otherwise) removes its watches
+void DiskUsageIndex::drop(Dir *dir, bool removeWatches) {
+  for (auto &subdir : dir->subdirs) {
+    drop(subdir.second, removeWatches);
+  }
+  if (dir->wd != -1 && removeWatches) {
+    byWatch.erase(dir->wd);
+    inotify_rm_watch(inotifyFd, dir->wd); // Fails harmlessly if the directory is already gone
+  }
+  delete dir;
+}
 
-      // If the entry is a directory, recursively calculate its size
-      if (S_ISDIR(entry_statbuf.st_mode)) {
-        total_size_kb += calculateDiskUsage(full_path.c_str());
-      }
+// Adds deltaKb to the totals of dir and of all its ancestors
+void DiskUsageIndex::addDelta(Dir *dir, long long deltaKb) {
+  for (; deltaKb != 0 && dir != nullptr; dir = dir->parent) {
+    dir->totalKb += deltaKb;
+  }
+}
 
-      // Move to the next directory entry
-      offset += d_entry->d_reclen;
+string DiskUsageIndex::pathOf(const Dir *dir) const {
+  vector<const string *> names;
+  for (; dir->parent != nullptr; dir = dir->parent) {
+    names.push_back(&dir->name);
+  }
+  string path = rootPath;
+  for (auto it = names.rbegin(); it != names.rend(); ++it) {
+    path += '/';
+    path += **it;
+  }
+  return path;
+}
+
+/**
+ * @brief Brings the index's record of one entry of a directory up to date.
+ * 
+ * Events may be coalesced, so rather than replaying them, the entry is looked up
+ * again and its record replaced by what is there now.
+ * 
+ * @param dir The directory the entry is in.
+ * @param name The entry's name.
+ * @param isNew True if the event says the name now refers to a new entry (created or
+ *              moved in), in which case a directory under that name is scanned again.
+ * @return None.
+ */
+void DiskUsageIndex::refreshEntry(Dir *dir, const string &name, bool isNew) {
+  string path = pathOf(dir) + "/" + name;
+  struct stat statbuf;
+  bool exists = (lstat(path.c_str(), &statbuf) == 0);
+  long long delta = 0;
+
+  auto file = dir->files.find(name);
+  if (file != dir->files.end()) {
+    delta -= file->second;
+    dir->files.erase(file);
+  }
+  auto subdir = dir->subdirs.find(name);
+  if (subdir != dir->subdirs.end() && (isNew || !exists || !S_ISDIR(statbuf.st_mode))) {
+    delta -= subdir->second->totalKb;
+    drop(subdir->second);
+    dir->subdirs.erase(subdir);
+    subdir = dir->subdirs.end();
+  }
+
+  if (exists && !S_ISDIR(statbuf.st_mode)) {
+    long long kb = _blocksToKb(statbuf.st_blocks);
+    dir->files[name] = kb;
+    delta += kb;
+  } else if (exists && subdir == dir->subdirs.end()) {
+    Dir *scanned = scan(dir, name, path);
+    if (scanned != nullptr) {
+      dir->subdirs[name] = scanned;
+      delta += scanned->totalKb;
     }
   }
+  addDelta(dir, delta);
+}
 
-  // Close the directory
-  if (close(dir_fd) == -1) {
-    perror("smash error: close failed");
+void DiskUsageIndex::applyEvent(const struct inotify_event *event, bool &overflow) {
+  if (event->mask & IN_Q_OVERFLOW) {
+    overflow = true;
+    return;
+  }
+  auto it = byWatch.find(event->wd);
+  if (it == byWatch.end()) {
+    return; // A directory that has been dropped from the index
+  }
+  Dir *dir = it->second;
+  if (event->mask & IN_IGNORED) {
+    // The directory itself is gone; its parent's event drops it from the index
+    byWatch.erase(it);
+    dir->wd = -1;
+    return;
+  }
+  if (event->len == 0) {
+    return; // An event about the directory itself
+  }
+  if (!(event->mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO))) {
+    // A write or attribute change: refreshed once when the batch is done
+    dirtyEntries.insert(make_pair(event->wd, string(event->name)));
+    return;
+  }
+
+  bool isNew = (event->mask & (IN_CREATE | IN_MOVED_TO)) != 0;
+  refreshEntry(dir, event->name, isNew);
+
+  // Adding and removing entries can change the size of the directory itself
+  if (event->mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)) {
+    struct stat statbuf;
+    if (lstat(pathOf(dir).c_str(), &statbuf) == 0) {
+      long long kb = _blocksToKb(statbuf.st_blocks);
+      addDelta(dir, kb - dir->selfKb);
+      dir->selfKb = kb;
+    }
+  }
+}
+
+// Reads and applies every queued inotify event; scans again after an overflow
+void DiskUsageIndex::applyPendingEvents() {
+  if (root == nullptr || getpid() != ownerPid) {
+    return; // A forked child (e.g. a pipeline stage) must not consume the shell's events
+  }
+  alignas(struct inotify_event) char buffer[64 * 1024];
+  bool overflow = false;
+  while (root != nullptr && !overflow) {
+    ssize_t bytes_read = read(inotifyFd, buffer, sizeof(buffer));
+    if (bytes_read <= 0) {
+      if (bytes_read == -1 && errno != EAGAIN && errno != EINTR) {
+        perror("smash error: read failed");
+      }
+      break;
+    }
+    for (ssize_t offset = 0; offset < bytes_read && !overflow;) {
+      const struct inotify_event *event = reinterpret_cast<const struct inotify_event *>(buffer + offset);
+      applyEvent(event, overflow);
+      offset += sizeof(struct inotify_event) + event->len;
+    }
+  }
+  for (const pair<int, string> &entry : dirtyEntries) {
+    auto it = byWatch.find(entry.first);
+    if (!overflow && it != byWatch.end()) { // An overflow scans everything again anyway
+      refreshEntry(it->second, entry.second, false);
+    }
+  }
+  dirtyEntries.clear();
+  if (root != nullptr && root->wd == -1) {
+    stop(); // The watched directory itself was removed
+  } else if (overflow || watchFailed) {
+    string path = rootPath;
+    watch(path);
+  }
+}
+
+/**
+ * @brief Scans a tree and starts keeping its per-directory usage current.
+ * 
+ * @param path The root of the tree.
+ * @return true on success; false (after printing an error) if the tree could not be
+ *         read or watched, e.g. if it has more directories than inotify watches allowed.
+ */
+bool DiskUsageIndex::watch(const string &path) {
+  stop();
+  char resolved[PATH_MAX];
+  if (realpath(path.c_str(), resolved) == nullptr) {
+    perror("smash error: realpath failed");
+    return false;
+  }
+  inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (inotifyFd == -1) {
+    perror("smash error: inotify_init1 failed");
+    return false;
+  }
+  rootPath = resolved;
+  ownerPid = getpid();
+  watchFailed = false;
+  string scratch = rootPath;
+  root = scan(nullptr, rootPath, scratch);
+  if (root == nullptr || watchFailed) {
+    stop();
+    return false;
+  }
+  return true;
+}
+
+void DiskUsageIndex::stop() {
+  if (root != nullptr) {
+    drop(root, getpid() == ownerPid); // A forked child only forgets its copy of the tree
+    root = nullptr;
+  }
+  byWatch.clear();
+  dirtyEntries.clear();
+  if (inotifyFd != -1) {
+    close(inotifyFd);
+    inotifyFd = -1;
+  }
+}
+
+bool DiskUsageIndex::lookup(const string &path, long long &totalKb) {
+  if (root == nullptr || getpid() != ownerPid) {
+    return false;
+  }
+  applyPendingEvents();
+  char resolved[PATH_MAX];
+  if (root == nullptr || realpath(path.c_str(), resolved) == nullptr) {
+    return false;
+  }
+
+  // Walk down from the root, one path component at a time
+  const Dir *dir = root;
+  string rest = resolved;
+  if (rest.compare(0, rootPath.size(), rootPath) != 0) {
+    return false;
   }
-  return total_size_kb;
+  rest = rest.substr(rootPath.size());
+  if (!rest.empty() && rest[0] != '/' && rootPath != "/") {
+    return false; // A sibling that shares the root's prefix
+  }
+  size_t start = 0;
+  while (dir != nullptr && start < rest.size()) {
+    if (rest[start] == '/') {
+      ++start;
+      continue;
+    }
+    size_t end = rest.find('/', start);
+    if (end == string::npos) {
+      end = rest.size();
+    }
+    auto it = dir->subdirs.find(rest.substr(start, end - start));
+    dir = (it != dir->subdirs.end()) ? it->second : nullptr;
+    start = end;
+  }
+  if (dir == nullptr) {
+    return false;
+  }
+  totalKb = dir->totalKb;
+  return true;
 }
 
 /**
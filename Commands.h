@@ -6,40 +6,215 @@
 #include <vector>
 #include <memory>
 #include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <sys/inotify.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
 #include <map>
+#include <set>
+#include <list>
+#include <unordered_map>
+#include <deque>
+#include <cstring>
+#include <stdint.h>
+#include <ostream>
+#include "signals.h"
 
 
 
 #define COMMAND_MAX_LENGTH (200)
 #define COMMAND_MAX_ARGS (20)
+#define COMMAND_CACHE_SIZE (256)
+#define JOBS_HISTORY_SIZE (100)
+#define RC_FILE_NAME ".smashrc"
+#define RC_SNAPSHOT_SUFFIX ".snap"
+#define RC_SNAPSHOT_VERSION (1)
 
 using namespace std;
 
+/*
+ * ArgView Class
+ *
+ * A non-owning view of a single argument. The characters live inside the
+ * ArgList arena of the owning Command and are NUL-terminated, so c_str()
+ * can be passed directly to system calls.
+ */
+class ArgView {
+    const char *ptr;
+    size_t len;
+
+public:
+    ArgView() : ptr(""), len(0) {}
+    ArgView(const char *ptr, size_t len) : ptr(ptr), len(len) {}
+
+    const char *c_str() const { return ptr; }
+    size_t size() const { return len; }
+    size_t length() const { return len; }
+    bool empty() const { return len == 0; }
+    char operator[](size_t i) const { return ptr[i]; }
+
+    string substr(size_t pos, size_t n = string::npos) const {
+        return string(ptr + pos, min(n, len - pos));
+    }
+    operator string() const { return string(ptr, len); }
+
+    bool operator==(const char *other) const { return strcmp(ptr, other) == 0; }
+    bool operator!=(const char *other) const { return !(*this == other); }
+    bool operator==(const string &other) const {
+        return other.size() == len && memcmp(ptr, other.data(), len) == 0;
+    }
+    bool operator!=(const string &other) const { return !(*this == other); }
+};
+
+inline ostream &operator<<(ostream &os, const ArgView &arg) {
+    return os.write(arg.c_str(), arg.size());
+}
+
+/*
+ * LineBuffer Class
+ *
+ * Holds a NUL-terminated copy of a command line inside the owning Command.
+ * Lines up to COMMAND_MAX_LENGTH characters are stored inline, so building
+ * a command does not touch the heap; only longer lines spill over.
+ */
+class LineBuffer {
+    char inline_buf[COMMAND_MAX_LENGTH + 1];
+    vector<char> overflow_buf;
+    char *buf;
+    size_t len;
+
+public:
+    LineBuffer() : buf(inline_buf), len(0) { inline_buf[0] = '\0'; }
+    LineBuffer(const LineBuffer &) = delete;
+    LineBuffer &operator=(const LineBuffer &) = delete;
+
+    void assign(const char *line, size_t n) {
+        if (n > COMMAND_MAX_LENGTH) {
+            overflow_buf.assign(line, line + n);
+            overflow_buf.push_back('\0');
+            buf = overflow_buf.data();
+        } else {
+            memcpy(inline_buf, line, n);
+            inline_buf[n] = '\0';
+            buf = inline_buf;
+        }
+        len = n;
+    }
+
+    const char *c_str() const { return buf; }
+    size_t size() const { return len; }
+    bool empty() const { return len == 0; }
+    char operator[](size_t i) const { return buf[i]; }
+    operator string() const { return string(buf, len); }
+};
+
+inline ostream &operator<<(ostream &os, const LineBuffer &line) {
+    return os.write(line.c_str(), line.size());
+}
+
+/*
+ * ArgList Class
+ *
+ * Tokenizes a command line in a single pass into an arena owned by the
+ * command. Lines up to COMMAND_MAX_LENGTH characters are stored inline;
+ * only longer lines (e.g. after alias expansion) touch the heap.
+ * The NULL-terminated argv() array points into the same arena and can be
+ * handed to execvp as-is.
+ */
+class ArgList {
+    char inline_arena[COMMAND_MAX_LENGTH + 1];
+    vector<char> overflow_arena;
+    ArgView views[COMMAND_MAX_ARGS];
+    char *argv_ptrs[COMMAND_MAX_ARGS + 1];
+    size_t count;
+
+public:
+    ArgList() : count(0) {
+        inline_arena[0] = '\0';
+        argv_ptrs[0] = nullptr;
+    }
+    ArgList(const ArgList &) = delete;
+    ArgList &operator=(const ArgList &) = delete;
+
+    /*
+     * Splits the first len characters of line on whitespace.
+     * Arguments beyond COMMAND_MAX_ARGS are dropped.
+     */
+    void parse(const char *line, size_t len);
+
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const ArgView &operator[](size_t i) const { return views[i]; }
+    const ArgView *begin() const { return views; }
+    const ArgView *end() const { return views + count; }
+    char *const *argv() const { return argv_ptrs; }
+};
+
 /*
  * Command Class Definition
  */
 class Command {
 protected:
-    string cmd_line;
-    string cmd_line_unedited;
-    vector<string> args;
+    LineBuffer cmd_line;
+    LineBuffer cmd_line_unedited;
+    ArgList args;
     bool is_background;
-    string alias;
 
 public:
     explicit Command(const char *cmd_line);
     virtual ~Command() = default;
 
     virtual void execute() = 0;
-    const string &getCmdLine() const { return cmd_line; }
-    const vector<string> &getArgs() const { return args; }
+    const LineBuffer &getCmdLine() const { return cmd_line; }
+    const ArgList &getArgs() const { return args; }
     bool isBackground() const { return is_background; }
-    string getAlias() const {
-        return alias;
+    void setUneditedCmdLine(const char *raw_cmd_line) {
+        cmd_line_unedited.assign(raw_cmd_line, strlen(raw_cmd_line));
     }
-    void setAlias(const string& aliasCommand) {
-        alias = aliasCommand;
+};
+
+/*
+ * JobPolicy Struct
+ *
+ * Scheduling and resource settings applied to a job's process between fork
+ * and exec (see the run builtin). Only the settings that were given are
+ * applied; description lists them as given, for jobs -l.
+ */
+struct JobPolicy {
+    bool hasCpus;
+    cpu_set_t cpus;
+    bool hasNice;
+    int nice;
+    bool hasIoprio;
+    int ioprio;       // Encoded as (class << 13) | level, as ioprio_set expects
+    bool hasRlimitAs;
+    rlim_t rlimitAs;
+    bool hasOomScore;
+    int oomScore;
+    string description;
+
+    JobPolicy() : hasCpus(false), hasNice(false), nice(0), hasIoprio(false), ioprio(0),
+                  hasRlimitAs(false), rlimitAs(0), hasOomScore(false), oomScore(0) {
+        CPU_ZERO(&cpus);
     }
+
+    bool empty() const { return description.empty(); }
+
+    /*
+     * Parses one option (without the leading "--") and its value.
+     * Returns false if the option is unknown or the value is invalid.
+     */
+    bool parseOption(const string &name, const string &value);
+
+    /*
+     * Applies the settings to the calling process. Exits the process if a
+     * setting cannot be applied, so a job never runs without its policy.
+     */
+    void apply() const;
 };
 
 /*
@@ -48,85 +223,258 @@ public:
  * This class manages a list of jobs (processes) running in the background.
  * It provides functionality to add, remove, and retrieve jobs, as well as
  * to clean up finished jobs and print the current job list.
+ *
+ * Jobs are kept in a slot table indexed directly by job ID. A bitmap of the
+ * occupied slots tracks the largest job ID, and a pid -> job ID index serves
+ * lookups by process, so adding, finding and removing a job are O(1)
+ * (finding the new largest ID after removing the largest one is amortized).
+ *
+ * With a slot limit set (jobslots N), background commands that would exceed
+ * N jobs wait in a FIFO queue of command lines until a job is reaped.
  */
 class JobsList {
 public:
     /*
      * JobEntry Class
      * Represents a single job entry with its ID, process ID, and command line.
+     * The job also holds a pidfd for its process, so signals reach the right
+     * process even if the PID is recycled; pidfd is -1 if the kernel lacks pidfds.
+     * A default-constructed entry (job ID 0) marks a free slot.
+     * Every job runs in its own process group, led by the job's process.
      */
     class JobEntry {
         int jobId;
         pid_t pid;
+        int pidfd;
         string cmdLine;
+        struct timespec startTime; // CLOCK_MONOTONIC
+        bool stopped;
+        string policy;             // JobPolicy::description of the job, if any
+
+        friend class JobsList;     // Changes the state, keeping the running-job count
+        void setStopped(bool value) { stopped = value; }
 
     public:
-        JobEntry(int jobId, pid_t pid, const string& cmdLine)
-            : jobId(jobId), pid(pid), cmdLine(cmdLine) {}
+        JobEntry() : jobId(0), pid(0), pidfd(-1), startTime(), stopped(false) {}
+        JobEntry(int jobId, pid_t pid, int pidfd, const string& cmdLine, bool stopped, const string &policy)
+            : jobId(jobId), pid(pid), pidfd(pidfd), cmdLine(cmdLine), stopped(stopped), policy(policy) {
+            clock_gettime(CLOCK_MONOTONIC, &startTime);
+        }
 
         int getJobId() const { return jobId; }
         pid_t getPid() const { return pid; }
+        int getPidFd() const { return pidfd; }
         const string& getCmdLine() const { return cmdLine; }
+        const struct timespec &getStartTime() const { return startTime; }
+        bool isStopped() const { return stopped; }
+        const string &getPolicy() const { return policy; }
+
+        /*
+         * Sends a signal to the job's process through its pidfd (or kill() without one).
+         * Returns 0 on success, -1 with errno set on failure.
+         */
+        int sendSignal(int signum) const {
+            if (pidfd >= 0) {
+                return syscall(SYS_pidfd_send_signal, pidfd, signum, nullptr, 0);
+            }
+            return kill(pid, signum);
+        }
+
+        /*
+         * Sends a signal to the job's whole process group, so every stage of a
+         * pipeline (or the children of bash -c) stops and continues together.
+         * Returns 0 on success, -1 with errno set on failure.
+         */
+        int sendGroupSignal(int signum) const {
+            return kill(-pid, signum);
+        }
     };
 
-private:
-    vector<JobEntry*> jobs; // List of job entries
+    /*
+     * FinishedJob Struct
+     * Accounting record of a job that exited: exit status and resource usage
+     * as reported by wait4, and how long it ran until its exit was observed.
+     */
+    struct FinishedJob {
+        int jobId;
+        pid_t pid;
+        string cmdLine;
+        int status;
+        double elapsedSeconds;
+        struct rusage usage;
+    };
 
-public:
-    
-    JobsList() {}
+private:
+    deque<JobEntry> slots;          // slots[jobId]; slot 0 is never used. Entries never move.
+    deque<FinishedJob> history;     // Most recent last, at most JOBS_HISTORY_SIZE entries
+    deque<string> queued;           // Raw lines of background commands waiting for a slot
+    size_t slotLimit;               // Maximal number of running jobs; 0 means unlimited
+    void (*slotFreedHandler)();     // Called when a reap frees a slot while lines are queued
+    unordered_map<pid_t, int> unclaimed; // Wait status of reaped children that are not jobs
+    vector<uint64_t> occupied;      // Bitmap of the job IDs in use
+    unordered_map<pid_t, int> pidIndex; // pid -> job ID
+    size_t jobCount;
+    size_t runningCount;            // Jobs that are not stopped, i.e. that hold a slot
+    int largestJobId;
+
+    bool isOccupied(int jobId) const {
+        return jobId > 0 && static_cast<size_t>(jobId) < slots.size() &&
+               (occupied[jobId / 64] >> (jobId % 64)) & 1;
+    }
 
-    ~JobsList() {
-        for (JobEntry* job : jobs) {
-            delete job;
+    /*
+     * Finds the largest occupied job ID that is smaller than jobId, or 0.
+     */
+    int findLargestBelow(int jobId) const {
+        if (jobId <= 1) {
+            return 0;
+        }
+        int word = (jobId - 1) / 64;
+        uint64_t bits = occupied[word] & (~0ULL >> (63 - (jobId - 1) % 64));
+        while (true) {
+            if (bits != 0) {
+                return word * 64 + 63 - __builtin_clzll(bits);
+            }
+            if (word == 0) {
+                return 0;
+            }
+            bits = occupied[--word];
         }
     }
 
+public:
+    
+    JobsList() : slotLimit(0), slotFreedHandler(nullptr), jobCount(0), runningCount(0), largestJobId(0) {}
+
     /*
      * Adds a new job to the list.
-     * Removes finished jobs before adding the new job.
+     * Callers remove finished jobs before forking the job's process, so the
+     * new job ID accounts for them and the reaper cannot collect the new
+     * child before it is in the table.
      * 
      * Parameters:
      * - cmdLine: The command line of the job.
      * - pid: The process ID of the job.
+     * - isStopped: Whether the job was stopped in the foreground (ctrl-Z).
+     * - policy: Description of the job's scheduling policy, if any.
      */
-    void addJob(string cmdLine, pid_t pid) {
-        removeFinishedJobs();
+    void addJob(string cmdLine, pid_t pid, bool isStopped = false, const string &policy = "") {
         int jobId = getLargestJobId() + 1;
-        jobs.push_back(new JobEntry(jobId, pid, cmdLine));
+        while (slots.size() <= static_cast<size_t>(jobId)) {
+            slots.emplace_back();
+        }
+        if (occupied.size() <= static_cast<size_t>(jobId / 64)) {
+            occupied.resize(jobId / 64 + 1, 0);
+        }
+        // The child is not reaped yet, so its PID cannot have been reused here
+        int pidfd = syscall(SYS_pidfd_open, pid, 0);
+        slots[jobId] = JobEntry(jobId, pid, pidfd, cmdLine, isStopped, policy);
+        occupied[jobId / 64] |= 1ULL << (jobId % 64);
+        pidIndex[pid] = jobId;
+        largestJobId = jobId;
+        ++jobCount;
+        runningCount += !isStopped;
     }
 
     /*
      * Prints the list of jobs to the standard output.
      */
     void printJobsList() const {
-        for (const JobEntry* job : jobs) {
-            cout << "[" << job->getJobId() << "] " << job->getCmdLine() << endl;
+        for (size_t word = 0; word < occupied.size(); ++word) {
+            for (uint64_t bits = occupied[word]; bits != 0; bits &= bits - 1) {
+                const JobEntry &job = slots[word * 64 + __builtin_ctzll(bits)];
+                cout << "[" << job.getJobId() << "] " << job.getCmdLine()
+                     << (job.isStopped() ? " (stopped)" : "") << endl;
+            }
+        }
+        for (const string &cmdLine : queued) {
+            cout << "[queued] " << cmdLine << endl;
         }
     }
 
     /*
      * Removes finished jobs from the list.
-     * Uses waitpid with WNOHANG to check if jobs have finished.
+     * Does nothing unless a SIGCHLD arrived since the last call; then reaps
+     * every exited child with wait4(-1, WNOHANG) and drops its entry through
+     * the pid index. The cost is proportional to the number of exits, not to
+     * the number of jobs. Stop and continue events (e.g. from kill -19/-18)
+     * update the job's state instead. The status of a child that is not a job
+     * (a foreground command) is kept for claimStatus.
+     * If a job exited or stopped and lines are queued, the slot freed handler
+     * starts them.
+     * An exited job's end time is when the SIGCHLD reporting it arrived, not
+     * when it is reaped.
      */
     void removeFinishedJobs() {
-        vector<JobEntry*> updatedJobs; // Temporary vector to store non-finished jobs
-        if (jobs.empty()) {
+        struct timespec end;
+        if (!consumeChildStateChanged(end)) {
             return;
         }
-        for (JobEntry* job : jobs) {
-            if (waitpid(job->getPid(), nullptr, WNOHANG) > 0) {
-                // Job has finished, delete it
-                delete job;
+        pid_t pid;
+        int status;
+        struct rusage usage;
+        bool freed = false;
+        while ((pid = wait4(-1, &status, WNOHANG | WUNTRACED | WCONTINUED, &usage)) > 0) {
+            JobEntry *job = getJobByPid(pid);
+            if (job == nullptr) {
+                unclaimed[pid] = status;
+                continue;
+            }
+            if (WIFSTOPPED(status)) {
+                setJobStopped(job, true);
+                freed = true;
+            } else if (WIFCONTINUED(status)) {
+                setJobStopped(job, false);
             } else {
-                // Job is still running, keep it
-                updatedJobs.push_back(job);
+                finishJob(job->getJobId(), status, usage, end);
+                freed = true;
             }
         }
-        // Replace the original jobs vector with the updated one
-        jobs = std::move(updatedJobs);
+        if (freed && !queued.empty() && slotFreedHandler != nullptr) {
+            slotFreedHandler();
+        }
+    }
+
+    /*
+     * Takes the wait status that removeFinishedJobs collected for a child
+     * that is not a job. Returns false if there is none.
+     */
+    bool claimStatus(pid_t pid, int &status) {
+        auto it = unclaimed.find(pid);
+        if (it == unclaimed.end()) {
+            return false;
+        }
+        status = it->second;
+        unclaimed.erase(it);
+        return true;
     }
 
+    void clearUnclaimed() { unclaimed.clear(); }
+
+    void setSlotFreedHandler(void (*handler)()) { slotFreedHandler = handler; }
+
+    /*
+     * Records the exit status and resource usage of a reaped job in the
+     * history, then removes it from the list.
+     * 
+     * Parameters:
+     * - jobId: The ID of the job that was reaped.
+     * - status: The wait status returned by wait4.
+     * - usage: The resource usage returned by wait4.
+     * - end: When the exit was observed (CLOCK_MONOTONIC).
+     */
+    void finishJob(int jobId, int status, const struct rusage &usage, const struct timespec &end);
+
+    /*
+     * Prints every job with its PID, state and elapsed time (jobs -l).
+     */
+    void printJobsListLong() const;
+
+    /*
+     * Prints the accounting records of recently finished jobs (jobs --done).
+     */
+    void printHistory() const;
+
     /*
      * Retrieves a job by its ID.
      * 
@@ -137,12 +485,18 @@ public:
      * - A pointer to the JobEntry if found, or nullptr if not found.
      */
     JobEntry* getJobById(int jobId) {
-        for (JobEntry* job : jobs) {
-            if (job->getJobId() == jobId) {
-                return job;
-            }
-        }
-        return nullptr;
+        return isOccupied(jobId) ? &slots[jobId] : nullptr;
+    }
+
+    /*
+     * Retrieves a job by the process ID of its process.
+     * 
+     * Returns:
+     * - A pointer to the JobEntry if found, or nullptr if not found.
+     */
+    JobEntry* getJobByPid(pid_t pid) {
+        auto it = pidIndex.find(pid);
+        return (it == pidIndex.end()) ? nullptr : &slots[it->second];
     }
 
     /*
@@ -152,11 +506,22 @@ public:
      * - jobId: The ID of the job to remove.
      */
     void removeJobById(int jobId) {
-        for (auto it = jobs.begin(); it != jobs.end(); ++it) {
-            if ((*it)->getJobId() == jobId) {
-                delete *it;
-                jobs.erase(it);
-                break;
+        if (!isOccupied(jobId)) {
+            return;
+        }
+        pidIndex.erase(slots[jobId].getPid());
+        if (slots[jobId].getPidFd() >= 0) {
+            close(slots[jobId].getPidFd());
+        }
+        runningCount -= !slots[jobId].isStopped();
+        slots[jobId] = JobEntry();
+        occupied[jobId / 64] &= ~(1ULL << (jobId % 64));
+        --jobCount;
+        if (jobId == largestJobId) {
+            largestJobId = findLargestBelow(jobId);
+            // Give back the slots above the new largest job ID
+            while (slots.size() > static_cast<size_t>(largestJobId) + 1) {
+                slots.pop_back();
             }
         }
     }
@@ -168,33 +533,108 @@ public:
      * - The largest job ID, or 0 if the list is empty.
      */
     int getLargestJobId() {
-        if (jobs.empty()) {
-            return 0;
+        return largestJobId;
+    }
+
+    bool isEmpty() const {
+        return jobCount == 0;
+    }
+
+    /*
+     * Retrieves the largest job ID among the stopped jobs.
+     * 
+     * Returns:
+     * - The largest stopped job ID, or 0 if no job is stopped.
+     */
+    int getLargestStoppedJobId() const {
+        for (int jobId = largestJobId; jobId > 0; jobId = findLargestBelow(jobId)) {
+            if (slots[jobId].isStopped()) {
+                return jobId;
+            }
         }
-        int maxId = 0;
-        for (const JobEntry* job : jobs) {
-            if (job->getJobId() > maxId) {
-                maxId = job->getJobId();
+        return 0;
+    }
+
+    size_t size() const { return jobCount; }
+
+    size_t getSlotLimit() const { return slotLimit; }
+    void setSlotLimit(size_t limit) { slotLimit = limit; }
+
+    /*
+     * Returns true if another job may start now. Only running jobs hold a
+     * slot: a stopped job gives its slot back until it is continued.
+     */
+    bool hasFreeSlot() const {
+        return slotLimit == 0 || runningCount < slotLimit;
+    }
+
+    /*
+     * Marks a job stopped or running. Every state change goes through here,
+     * so the running-job count behind hasFreeSlot stays exact.
+     */
+    void setJobStopped(JobEntry *job, bool stopped) {
+        if (job->isStopped() != stopped) {
+            if (stopped) {
+                --runningCount;
+            } else {
+                ++runningCount;
             }
+            job->setStopped(stopped);
         }
-        return maxId;
     }
 
-    bool isEmpty() const {
-        return jobs.empty();
+    bool hasQueuedJobs() const { return !queued.empty(); }
+
+    /*
+     * Appends a background command line to the queue of jobs waiting for a slot.
+     */
+    void queueJob(const string &cmdLine) {
+        queued.push_back(cmdLine);
     }
 
-    const vector<JobEntry*>& getJobs() const { return jobs; }
+    /*
+     * Removes the oldest queued command line.
+     * Returns false if the queue is empty.
+     */
+    bool popQueuedJob(string &cmdLine) {
+        if (queued.empty()) {
+            return false;
+        }
+        cmdLine = queued.front();
+        queued.pop_front();
+        return true;
+    }
+
+    /*
+     * Returns pointers to all jobs, ordered by job ID.
+     */
+    vector<JobEntry*> getJobs() {
+        vector<JobEntry*> result;
+        result.reserve(jobCount);
+        for (size_t word = 0; word < occupied.size(); ++word) {
+            for (uint64_t bits = occupied[word]; bits != 0; bits &= bits - 1) {
+                result.push_back(&slots[word * 64 + __builtin_ctzll(bits)]);
+            }
+        }
+        return result;
+    }
 
     /*
      * Clears all jobs from the list.
-     * Deletes all dynamically allocated JobEntry objects.
      */
     void clearJobs() {
-        for (JobEntry* job : jobs) {
-            delete job;
+        for (const JobEntry &job : slots) {
+            if (job.getPidFd() >= 0) {
+                close(job.getPidFd());
+            }
         }
-        jobs.clear();
+        slots.clear();
+        queued.clear();
+        occupied.clear();
+        pidIndex.clear();
+        jobCount = 0;
+        runningCount = 0;
+        largestJobId = 0;
     }
 };
 
@@ -210,14 +650,62 @@ public:
 /*
  * Command Family Definitions
  */
+/*
+ * ExternalCommand Class
+ *
+ * Base of the commands that run a program. Processes are started with
+ * posix_spawn (which uses a CLONE_VM|CLONE_VFORK child in glibc, so the cost
+ * does not grow with the shell's memory), with the process group and the fd
+ * wiring given as spawn attributes and file actions. Commands with a JobPolicy
+ * still fork, because the policy has to be applied between fork and exec.
+ */
 class ExternalCommand : public Command {
 protected:
     JobsList &jobs;
+    JobPolicy policy; // Recorded on the job; applied by RunCommand::execChild
+    int stdout_fd;    // If not -1, becomes the command's stdout (see RedirectionCommand)
 
 public:
-    explicit ExternalCommand(const char *cmd_line, JobsList& jobs) : Command(cmd_line), jobs(jobs) {};
+    explicit ExternalCommand(const char *cmd_line, JobsList& jobs) : Command(cmd_line), jobs(jobs), stdout_fd(-1) {};
     virtual ~ExternalCommand() = default;
 
+    void redirectStdout(int fd) { stdout_fd = fd; }
+
+    /*
+     * Runs the command, or queues it if it is a background command and every
+     * job slot is taken.
+     */
+    void execute() override;
+
+    /*
+     * Runs the command now, bypassing the job slot queue. Waits for a
+     * foreground command; adds a background command to the jobs list.
+     */
+    void launch();
+
+    /*
+     * Starts the command in a new process without waiting for it.
+     * 
+     * Parameters:
+     * - pgid: The process group to join, or 0 for a new group led by the child.
+     * - in_fd: If not -1, becomes the child's stdin.
+     * - out_fd: If not -1, becomes the child's out_target (stdout or stderr).
+     * 
+     * Returns:
+     * - The child's PID, or -1 (after printing an error) if it could not be started.
+     */
+    pid_t spawn(pid_t pgid, int in_fd, int out_fd, int out_target);
+
+    /*
+     * Builds the argv to exec. storage holds any strings argv points into.
+     */
+    virtual void buildArgv(vector<char *> &argv, string &storage) const = 0;
+
+    /*
+     * Replaces the calling (already forked) process with the command.
+     * Never returns: exits the process if the exec fails.
+     */
+    virtual void execChild();
 };
 
 class SimpleExternalCommand : public ExternalCommand {
@@ -225,7 +713,7 @@ public:
     explicit SimpleExternalCommand(const char *cmd_line, JobsList& jobs) : ExternalCommand(cmd_line, jobs) {};
     virtual ~SimpleExternalCommand() = default;
 
-    void execute() override;
+    void buildArgv(vector<char *> &argv, string &storage) const override;
 };
 
 class ComplexExternalCommand : public ExternalCommand {
@@ -233,7 +721,45 @@ public:
     explicit ComplexExternalCommand(const char *cmd_line, JobsList& jobs) : ExternalCommand(cmd_line, jobs) {};
     virtual ~ComplexExternalCommand() = default;
 
+    void buildArgv(vector<char *> &argv, string &storage) const override;
+};
+
+/*
+ * GlobExternalCommand Class
+ *
+ * An external command whose arguments contain * or ? wildcards but no other
+ * shell syntax. smash expands the wildcards itself (see buildArgv) and execs
+ * the program directly, instead of going through /bin/bash -c.
+ */
+class GlobExternalCommand : public ExternalCommand {
+public:
+    explicit GlobExternalCommand(const char *cmd_line, JobsList& jobs) : ExternalCommand(cmd_line, jobs) {};
+    virtual ~GlobExternalCommand() = default;
+
+    void buildArgv(vector<char *> &argv, string &storage) const override;
+};
+
+/*
+ * RunCommand Class
+ *
+ * run [--cpus LIST] [--nice N] [--ioprio CLASS[:LEVEL]] [--rlimit-as SIZE]
+ *     [--oom-score N] <command>
+ * Runs an external command with a scheduling policy applied in the child
+ * between fork and exec. The command is built like any other command line,
+ * so aliases and wildcards work as usual.
+ */
+class RunCommand : public ExternalCommand {
+private:
+    unique_ptr<Command> command;
+    bool valid;
+
+public:
+    RunCommand(const char *cmd_line, JobsList &jobs);
+    virtual ~RunCommand() = default;
+
     void execute() override;
+    void buildArgv(vector<char *> &argv, string &storage) const override;
+    void execChild() override;
 };
 
 class RedirectionCommand : public Command {
@@ -252,9 +778,29 @@ public:
     void execute() override;
 };
 
+/*
+ * FanOutCommand Class
+ *
+ * producer |> consumer1 |> consumer2 ...: every consumer reads a copy of the
+ * producer's stdout. The shell relays the data between the pipes with
+ * tee/splice and reports how many bytes each consumer received.
+ */
+class FanOutCommand : public Command {
+public:
+    explicit FanOutCommand(const char *cmd_line) : Command(cmd_line) {};
+    virtual ~FanOutCommand() = default;
+
+    void execute() override;
+};
+
 class DiskUsageCommand : public Command {
+public:
+    /* A directory listed by du --depth or du --top: its total (KB) and path */
+    typedef pair<long long, string> Listed;
+
 private:
-    long long calculateDiskUsage(const char* path);
+    long long calculateDiskUsage(const char* path, int threads, bool use_uring, int list_depth, int top_n,
+                                 vector<Listed> &listed);
 
 public:
     explicit DiskUsageCommand(const char *cmd_line) : Command(cmd_line) {};
@@ -341,9 +887,7 @@ private:
     JobsList &jobs;
 
 public:
-    KillCommand(const char *cmd_line, JobsList &jobs) : BuiltInCommand(cmd_line), jobs(jobs) {
-        jobs.removeFinishedJobs();
-    };
+    KillCommand(const char *cmd_line, JobsList &jobs) : BuiltInCommand(cmd_line), jobs(jobs) {};
     virtual ~KillCommand() = default;
 
     void execute() override;
@@ -365,6 +909,39 @@ public:
     void execute() override;
 };
 
+class StopCommand : public BuiltInCommand {
+private:
+    JobsList &jobs;
+
+public:
+    StopCommand(const char *cmd_line, JobsList &jobs) : BuiltInCommand(cmd_line), jobs(jobs) {}
+    virtual ~StopCommand() = default;
+
+    void execute() override;
+};
+
+class BackgroundCommand : public BuiltInCommand {
+private:
+    JobsList &jobs;
+
+public:
+    BackgroundCommand(const char *cmd_line, JobsList &jobs) : BuiltInCommand(cmd_line), jobs(jobs) {}
+    virtual ~BackgroundCommand() = default;
+
+    void execute() override;
+};
+
+class WaitCommand : public BuiltInCommand {
+private:
+    JobsList &jobs;
+
+public:
+    WaitCommand(const char *cmd_line, JobsList &jobs) : BuiltInCommand(cmd_line), jobs(jobs) {}
+    virtual ~WaitCommand() = default;
+
+    void execute() override;
+};
+
 /*
  * Alias and Environment Commands
  */
@@ -400,6 +977,33 @@ public:
     void execute() override;
 };
 
+class HashCommand : public BuiltInCommand {
+public:
+    explicit HashCommand(const char *cmd_line) : BuiltInCommand(cmd_line) {}
+    virtual ~HashCommand() = default;
+
+    void execute() override;
+};
+
+class CacheStatsCommand : public BuiltInCommand {
+public:
+    explicit CacheStatsCommand(const char *cmd_line) : BuiltInCommand(cmd_line) {}
+    virtual ~CacheStatsCommand() = default;
+
+    void execute() override;
+};
+
+class JobSlotsCommand : public BuiltInCommand {
+private:
+    JobsList &jobs;
+
+public:
+    JobSlotsCommand(const char *cmd_line, JobsList &jobs) : BuiltInCommand(cmd_line), jobs(jobs) {}
+    virtual ~JobSlotsCommand() = default;
+
+    void execute() override;
+};
+
 class WatchProcCommand : public BuiltInCommand {
 public:
     explicit WatchProcCommand(const char *cmd_line) : BuiltInCommand(cmd_line) {};
@@ -412,6 +1016,236 @@ private:
     double readMemoryUsage(pid_t pid);
 };
 
+class SmallShell;
+
+// Creates a heap-allocated command object for an already-expanded command line
+typedef Command *(*CommandFactory)(const char *cmd_line, SmallShell &smash);
+
+// Constructs a command in place on the stack, executes it and destroys it
+typedef void (*CommandRunner)(const char *cmd_line, const char *raw_cmd_line, SmallShell &smash);
+
+// The two ways of instantiating one command class
+struct CommandOps {
+    CommandFactory create;
+    CommandRunner run;
+};
+
+/*
+ * CommandCache Class
+ *
+ * An LRU cache of parsed command lines keyed by the raw line as typed.
+ * Each entry holds the operations that build the command and the trimmed,
+ * alias-expanded line to build it from, so a repeated line skips alias
+ * lookup, trimming and redirection/pipe/builtin classification.
+ * Entries depend on the alias map and must be cleared when it changes.
+ */
+class CommandCache {
+public:
+    struct ParsedLine {
+        const CommandOps *ops;
+        string cmd_line;
+    };
+
+private:
+    typedef list<pair<string, ParsedLine>> LruList;
+
+    LruList lru; // Most recently used entry first
+    unordered_map<string, LruList::iterator> index;
+    size_t capacity;
+    unsigned long long hits;
+    unsigned long long misses;
+
+public:
+    explicit CommandCache(size_t capacity) : capacity(capacity), hits(0), misses(0) {}
+
+    /*
+     * Looks up a raw command line and marks it as most recently used.
+     *
+     * Returns:
+     * - The cached parsed line, or nullptr on a miss.
+     */
+    const ParsedLine *find(const string &raw_cmd_line) {
+        auto it = index.find(raw_cmd_line);
+        if (it == index.end()) {
+            ++misses;
+            return nullptr;
+        }
+        ++hits;
+        lru.splice(lru.begin(), lru, it->second);
+        return &it->second->second;
+    }
+
+    /*
+     * Inserts a parsed line, evicting the least recently used entry if full.
+     */
+    void insert(const string &raw_cmd_line, const ParsedLine &parsed) {
+        if (capacity == 0 || index.count(raw_cmd_line)) {
+            return;
+        }
+        if (lru.size() >= capacity) {
+            index.erase(lru.back().first);
+            lru.pop_back();
+        }
+        lru.emplace_front(raw_cmd_line, parsed);
+        index[raw_cmd_line] = lru.begin();
+    }
+
+    /*
+     * Drops every entry. Called whenever the alias map changes.
+     */
+    void clear() {
+        lru.clear();
+        index.clear();
+    }
+
+    size_t size() const { return lru.size(); }
+    size_t getCapacity() const { return capacity; }
+    unsigned long long getHits() const { return hits; }
+    unsigned long long getMisses() const { return misses; }
+};
+
+/*
+ * PathCache Class
+ *
+ * Maps command names to the absolute path of the executable that PATH
+ * resolves them to, so a repeated command is exec'd with execve directly
+ * instead of execvp trying every PATH directory in turn.
+ * The cache is cleared when PATH changes. On a hit, only the directory the
+ * executable was found in is checked, and at most once per second: if its
+ * mtime changed, the entries found in it are dropped. As in bash, a newer
+ * executable placed in an earlier PATH directory is not noticed until
+ * `hash -r`, since re-checking every earlier directory would cost the same
+ * metadata round trips as searching PATH.
+ * Names found in relative PATH directories are resolved but not cached.
+ */
+class PathCache {
+public:
+    struct Entry {
+        string path;
+        size_t dirIndex; // Index in dirs of the directory the executable is in
+        unsigned long long hits;
+    };
+
+private:
+    struct Dir {
+        string path;
+        bool statted;
+        struct timespec mtime;   // When the directory was last searched
+        struct timespec checked; // CLOCK_MONOTONIC time of that stat
+    };
+
+    bool initialized;
+    string pathValue;  // The PATH the entries were resolved against
+    vector<Dir> dirs;
+    map<string, Entry> entries;
+    string uncached;   // Result of the last lookup that could not be cached
+
+    void reset(const char *path);
+    bool dirUnchanged(size_t dirIndex);
+    void statDir(Dir &dir);
+
+public:
+    PathCache() : initialized(false) {}
+
+    /*
+     * Resolves a command name through PATH.
+     *
+     * Returns:
+     * - The absolute path of the executable, or nullptr if the name contains
+     *   a '/' or is not found. Valid until the next call.
+     */
+    const string *resolve(const string &name);
+
+    /*
+     * Drops every entry (hash -r).
+     */
+    void clear() {
+        entries.clear();
+        for (Dir &dir : dirs) {
+            dir.statted = false;
+        }
+    }
+
+    const map<string, Entry> &getEntries() const { return entries; }
+};
+
+/*
+ * DiskUsageIndex Class
+ *
+ * The disk usage of every directory of one tree (du --watch), so that du
+ * can answer for any directory in it without walking it. The tree is
+ * scanned once and then kept current from inotify events, which are applied
+ * when du is queried: each one updates the entry it names and adds the
+ * difference to the totals of that directory and of all its ancestors.
+ * If the inotify queue overflows, the tree is scanned again.
+ */
+class DiskUsageIndex {
+    struct Dir {
+        Dir *parent;
+        string name;     // Relative to the parent (rootPath for the root)
+        int wd;          // inotify watch descriptor, -1 once the watch is gone
+        long long selfKb;  // The directory's own blocks
+        long long totalKb; // selfKb plus everything below the directory
+        unordered_map<string, long long> files; // Non-directory entries -> KB
+        unordered_map<string, Dir *> subdirs;
+    };
+
+    int inotifyFd;
+    string rootPath;
+    Dir *root;
+    unordered_map<int, Dir *> byWatch;
+    set<pair<int, string>> dirtyEntries; // (wd, name) written to since the last refresh
+    bool watchFailed;
+    pid_t ownerPid;    // The shell; forked children do not use the index
+
+    Dir *scan(Dir *parent, const string &name, string &path);
+    void drop(Dir *dir, bool removeWatches = true);
+    void addDelta(Dir *dir, long long deltaKb);
+    string pathOf(const Dir *dir) const;
+    void refreshEntry(Dir *dir, const string &name, bool isNew);
+    void applyEvent(const struct inotify_event *event, bool &overflow);
+
+public:
+    DiskUsageIndex() : inotifyFd(-1), root(nullptr), watchFailed(false), ownerPid(-1) {}
+    ~DiskUsageIndex() { stop(); }
+
+    DiskUsageIndex(const DiskUsageIndex &) = delete;
+    DiskUsageIndex &operator=(const DiskUsageIndex &) = delete;
+
+    /*
+     * Scans the tree at path and starts watching it, replacing the tree
+     * watched so far. Returns false (after printing an error) on failure.
+     */
+    bool watch(const string &path);
+
+    /*
+     * Stops watching and drops the index. In a forked child (e.g. one leaving
+     * through exit(), which runs this from the destructor) the watches are
+     * left alone: the inotify instance is shared with the shell.
+     */
+    void stop();
+
+    /*
+     * The inotify fd while a tree is watched (else -1). The shell polls it
+     * while idle at the prompt and calls applyPendingEvents when it is
+     * readable, so the event queue does not overflow between lookups.
+     */
+    int getFd() const { return root != nullptr ? inotifyFd : -1; }
+
+    /*
+     * Reads and applies every queued event; does nothing in a forked child.
+     */
+    void applyPendingEvents();
+
+    /*
+     * Applies the pending events, then looks up the total of a directory.
+     *
+     * Returns:
+     * - true with totalKb set if path is a directory of the watched tree.
+     */
+    bool lookup(const string &path, long long &totalKb);
+};
+
 /*
  * SmallShell Singleton Class
  */
@@ -424,9 +1258,24 @@ private:
     string prevWorkingDir;
     JobsList jobs;
     map<string, string> aliasMap;
+    unordered_map<string, string> aliasExpansions; // Alias name -> fully expanded command
+    CommandCache commandCache;
+    string lookupKey; // Reused for command cache lookups, so a hit does not allocate
+    PathCache pathCache;
+    DiskUsageIndex duIndex;
 
     SmallShell();
 
+    CommandCache::ParsedLine parseCommandLine(const string &cmd_s_unedited);
+    bool createsAliasLoop(const string &aliasName, const string &aliasCommand) const;
+    const string &expandAlias(const string &aliasName);
+    void rebuildAliasExpansions();
+    bool loadRcSnapshot(const string &snapshotPath, const struct stat &rcStat);
+    void compileRcFile(const string &rcPath, vector<pair<string, string>> &envOverrides);
+    void writeRcSnapshot(const string &snapshotPath, const struct stat &rcStat,
+                         const vector<pair<string, string>> &envOverrides) const;
+    const CommandCache::ParsedLine *lookupCommandLine(const char *cmd_line, CommandCache::ParsedLine &fresh);
+
 public:
     SmallShell(SmallShell const &) = delete;
     void operator=(SmallShell const &) = delete;
@@ -440,6 +1289,19 @@ public:
 
     Command *CreateCommand(const char *cmd_line);
     void executeCommand(const char *cmd_line);
+    vector<int> startQueuedJobs();
+
+    /*
+     * Waits for a foreground child to exit or stop, like waitpid(pid, status,
+     * WUNTRACED), reaping background jobs (and so starting queued lines) as
+     * they finish in the meantime.
+     */
+    pid_t waitForeground(pid_t pid, int *status);
+
+    /*
+     * Blocks until fd is readable, reaping background jobs as they finish.
+     */
+    void waitForInput(int fd);
 
     void setPrompt(const string &newPrompt) { prompt = newPrompt; }
     string getPrompt() const { return prompt; }
@@ -452,12 +1314,18 @@ public:
     }
 
     JobsList &getJobsList() { return jobs; }
+    map<string, string> &getAliasMap() { return aliasMap; }
+    CommandCache &getCommandCache() { return commandCache; }
+    PathCache &getPathCache() { return pathCache; }
+    DiskUsageIndex &getDiskUsageIndex() { return duIndex; }
 
     void setAlias(const string& aliasName, const string& aliasCommand);
     void removeAlias(const string& aliasName);
     string getAlias(const string& aliasName) const;
     void printAliases() const;
 
+    void loadRcFile();
+
     void setForegroundPid(pid_t pid) {
         foreground_pid = pid;
         is_foreground_running = true;
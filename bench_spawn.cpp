@@ -0,0 +1,89 @@
+#include <iostream>
+#include <iomanip>
+#include <unistd.h>
+#include <spawn.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <cstring>
+#include <cstdlib>
+#include <vector>
+
+using namespace std;
+
+// Compares the two ways smash can start an external command: fork + execv (what
+// smash still does for `run` policies and built-in pipeline stages) against
+// posix_spawn (the default path). Each run starts /bin/true with its own process
+// group and waits for it, for growing amounts of resident shell memory.
+//
+// Usage: bench_spawn [iterations] [max heap MB]
+
+static double nowMicros() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static char *const trueArgv[] = {const_cast<char *>("/bin/true"), nullptr};
+
+static double benchFork(int iterations) {
+    double start = nowMicros();
+    for (int i = 0; i < iterations; ++i) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            setpgrp();
+            execv(trueArgv[0], trueArgv);
+            _exit(1);
+        }
+        waitpid(pid, nullptr, 0);
+    }
+    return (nowMicros() - start) / iterations;
+}
+
+static double benchSpawn(int iterations) {
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+    posix_spawnattr_setpgroup(&attr, 0);
+    double start = nowMicros();
+    for (int i = 0; i < iterations; ++i) {
+        pid_t pid;
+        if (posix_spawn(&pid, trueArgv[0], nullptr, &attr, trueArgv, environ) == 0) {
+            waitpid(pid, nullptr, 0);
+        }
+    }
+    double elapsed = nowMicros() - start;
+    posix_spawnattr_destroy(&attr);
+    return elapsed / iterations;
+}
+
+int main(int argc, char *argv[]) {
+    int iterations = (argc > 1) ? atoi(argv[1]) : 2000;
+    size_t maxHeapMb = (argc > 2) ? strtoul(argv[2], nullptr, 10) : 256;
+
+    vector<char *> blocks;
+    size_t heapMb = 0;
+    cout << "heap MB   fork+exec us   posix_spawn us   speedup" << endl;
+    while (true) {
+        double forkUs = benchFork(iterations);
+        double spawnUs = benchSpawn(iterations);
+        cout << setw(7) << heapMb << fixed << setprecision(1)
+             << setw(15) << forkUs << setw(17) << spawnUs
+             << setw(9) << setprecision(2) << forkUs / spawnUs << "x" << endl;
+
+        if (heapMb >= maxHeapMb) {
+            break;
+        }
+        // Grow the resident set: the pages must be touched to be mapped
+        size_t growMb = (heapMb == 0) ? 16 : heapMb;
+        char *block = static_cast<char *>(malloc(growMb << 20));
+        memset(block, 1, growMb << 20);
+        blocks.push_back(block);
+        heapMb += growMb;
+    }
+
+    for (char *block : blocks) {
+        free(block);
+    }
+    return 0;
+}
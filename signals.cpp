@@ -1,12 +1,29 @@
 #include <iostream>
 #include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <atomic>
 #include "signals.h"
 #include "Commands.h"
 
 using namespace std;
 
+// Set by the SIGCHLD handler, consumed by the jobs list reaper
+static volatile sig_atomic_t childStateChanged = 0;
+
+// When the latest SIGCHLD arrived (CLOCK_MONOTONIC, in ns); lock-free, so safe to set in the handler
+static std::atomic<long long> childEventTime(0);
+
+// Self-pipe written by the SIGCHLD handler, so that a poll can wake up on child events
+static int childEventPipe[2] = {-1, -1};
+
+// Set by the ctrl-C handler, consumed by builtins that block (e.g. wait)
+static volatile sig_atomic_t ctrlCPressed = 0;
+
 void ctrlCHandler(int sig_num) {
     cout << "smash: got ctrl-C" << endl;
+    ctrlCPressed = 1;
 
     SmallShell& smash = SmallShell::getInstance();
     pid_t fg_pid = smash.getForegroundPid();
@@ -21,3 +38,70 @@ void ctrlCHandler(int sig_num) {
         smash.clearForegroundPid();
     } 
 }
+
+void ctrlZHandler(int sig_num) {
+    cout << "smash: got ctrl-Z" << endl;
+
+    SmallShell& smash = SmallShell::getInstance();
+    pid_t fg_pid = smash.getForegroundPid();
+
+    if (fg_pid > 0) {
+        // Stop the whole foreground process group; the command waiting for it
+        // sees the stop and moves it to the jobs list.
+        if (kill(-fg_pid, SIGSTOP) == -1) {
+            perror("smash error: kill failed");
+        } else {
+            std::cout << "smash: process " << fg_pid << " was stopped" << std::endl;
+        }
+    }
+}
+
+void sigchldHandler(int sig_num) {
+    // Only record the event; reaping happens in JobsList::removeFinishedJobs,
+    // outside of signal context. The time is taken here, since the exit is
+    // recorded whenever the reaper gets to it.
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    childEventTime.store(now.tv_sec * 1000000000LL + now.tv_nsec);
+    childStateChanged = 1;
+    if (childEventPipe[1] != -1) {
+        int savedErrno = errno;
+        char byte = 0;
+        (void)!write(childEventPipe[1], &byte, 1); // A full pipe already signals the event
+        errno = savedErrno;
+    }
+}
+
+bool consumeChildStateChanged(struct timespec &when) {
+    if (!childStateChanged) {
+        return false;
+    }
+    // Cleared before reaping, so a child exiting during the reap is not missed
+    childStateChanged = 0;
+    long long ns = childEventTime.load();
+    when.tv_sec = ns / 1000000000LL;
+    when.tv_nsec = ns % 1000000000LL;
+    return true;
+}
+
+bool initChildEventFd() {
+    return pipe2(childEventPipe, O_NONBLOCK | O_CLOEXEC) == 0;
+}
+
+int getChildEventFd() {
+    return childEventPipe[0];
+}
+
+void drainChildEventFd() {
+    char buffer[64];
+    while (childEventPipe[0] != -1 && read(childEventPipe[0], buffer, sizeof(buffer)) > 0) {
+    }
+}
+
+bool consumeCtrlC() {
+    if (!ctrlCPressed) {
+        return false;
+    }
+    ctrlCPressed = 0;
+    return true;
+}
@@ -1,6 +1,24 @@
 #ifndef SMASH__SIGNALS_H_
 #define SMASH__SIGNALS_H_
 
+#include <time.h>
+
 void ctrlCHandler(int sig_num);
+void ctrlZHandler(int sig_num);
+void sigchldHandler(int sig_num);
+
+// Returns true (once) if a SIGCHLD arrived since the last call, with the
+// CLOCK_MONOTONIC time the latest one arrived
+bool consumeChildStateChanged(struct timespec &when);
+
+// Creates the pipe the SIGCHLD handler writes to, so that waits can poll for child events
+bool initChildEventFd();
+
+// The read end of that pipe (-1 before initChildEventFd), and emptying it
+int getChildEventFd();
+void drainChildEventFd();
+
+// Returns true (once) if ctrl-C was pressed since the last call
+bool consumeCtrlC();
 
 #endif //SMASH__SIGNALS_H_
@@ -1,18 +1,212 @@
 #include <iostream>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
 #include <signal.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include "Commands.h"
 #include "signals.h"
 
+#define SCRIPT_QUEUE_SIZE (1024) // Must be a power of 2
+
+/*
+ * ScriptLineQueue Class
+ *
+ * Single-producer/single-consumer lock-free ring of script lines.
+ * The reader thread pushes the location of each non-blank, trimmed line of
+ * the mmapped script while the main thread executes the previous ones.
+ * Pushing and popping take no lock while the ring is neither full nor empty.
+ * A side that finds it full (or empty) sleeps on a condition variable; the
+ * other side only takes the lock to wake it, on the full->non-full (or
+ * empty->non-empty) transition, when the sleeper has announced itself.
+ */
+class ScriptLineQueue {
+public:
+    struct Line {
+        size_t offset;
+        size_t length;
+    };
+
+private:
+    Line ring[SCRIPT_QUEUE_SIZE];
+    std::atomic<size_t> head; // Next slot to pop (consumer)
+    std::atomic<size_t> tail; // Next slot to push (producer)
+    std::atomic<bool> done;
+    std::atomic<bool> producerWaiting;
+    std::atomic<bool> consumerWaiting;
+    std::mutex lock;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+
+    // Wakes the other side if it announced that it is sleeping
+    void wake(std::atomic<bool> &waiting, std::condition_variable &cv) {
+        if (waiting.load()) {
+            std::lock_guard<std::mutex> guard(lock);
+            cv.notify_one();
+        }
+    }
+
+public:
+    ScriptLineQueue() : head(0), tail(0), done(false), producerWaiting(false), consumerWaiting(false) {}
+
+    // Producer side. Sleeps while the ring is full.
+    void push(const Line &line) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == SCRIPT_QUEUE_SIZE) {
+            std::unique_lock<std::mutex> guard(lock);
+            producerWaiting.store(true); // Sequentially consistent with the pop's store of head
+            notFull.wait(guard, [&] { return t - head.load() != SCRIPT_QUEUE_SIZE; });
+            producerWaiting.store(false);
+        }
+        ring[t & (SCRIPT_QUEUE_SIZE - 1)] = line;
+        tail.store(t + 1);
+        wake(consumerWaiting, notEmpty);
+    }
+
+    void close() {
+        done.store(true);
+        wake(consumerWaiting, notEmpty);
+    }
+
+    // Consumer side. Returns false once the producer is done and the ring is drained.
+    bool pop(Line &line) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) {
+            std::unique_lock<std::mutex> guard(lock);
+            consumerWaiting.store(true);
+            notEmpty.wait(guard, [&] { return h != tail.load() || done.load(); });
+            consumerWaiting.store(false);
+            if (h == tail.load()) {
+                return false;
+            }
+        }
+        line = ring[h & (SCRIPT_QUEUE_SIZE - 1)];
+        head.store(h + 1);
+        wake(producerWaiting, notFull);
+        return true;
+    }
+};
+
+static bool isWhitespace(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v';
+}
+
+// Reader thread: splits the script into trimmed, non-blank lines
+static void scanScript(const char *data, size_t size, ScriptLineQueue *queue) {
+    size_t pos = 0;
+    while (pos < size) {
+        const char *newline = static_cast<const char *>(memchr(data + pos, '\n', size - pos));
+        size_t end = newline ? static_cast<size_t>(newline - data) : size;
+        size_t start = pos;
+        while (start < end && isWhitespace(data[start])) {
+            ++start;
+        }
+        size_t stop = end;
+        while (stop > start && isWhitespace(data[stop - 1])) {
+            --stop;
+        }
+        if (stop > start) {
+            queue->push(ScriptLineQueue::Line{start, stop - start});
+        }
+        pos = end + 1;
+    }
+    queue->close();
+}
+
+/*
+ * Runs a script file without prompts. The file is mmapped and a reader thread
+ * splits it into lines ahead of execution. Parsing into commands stays on the
+ * main thread, since it depends on aliases defined by earlier lines.
+ */
+static int runScript(SmallShell &smash, const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        perror("smash error: open failed");
+        return 1;
+    }
+    struct stat statbuf;
+    if (fstat(fd, &statbuf) == -1) {
+        perror("smash error: fstat failed");
+        close(fd);
+        return 1;
+    }
+    size_t size = statbuf.st_size;
+    if (size == 0) {
+        close(fd);
+        return 0;
+    }
+    void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (close(fd) == -1) {
+        perror("smash error: close failed");
+    }
+    if (mapped == MAP_FAILED) {
+        perror("smash error: mmap failed");
+        return 1;
+    }
+    const char *data = static_cast<const char *>(mapped);
+    madvise(mapped, size, MADV_SEQUENTIAL);
+
+    ScriptLineQueue *queue = new ScriptLineQueue();
+    std::thread reader(scanScript, data, size, queue);
+
+    std::string cmd_line; // Reused, so its capacity is allocated once
+    ScriptLineQueue::Line line;
+    while (queue->pop(line)) {
+        cmd_line.assign(data + line.offset, line.length);
+        smash.executeCommand(cmd_line.c_str());
+    }
+
+    reader.join();
+    delete queue;
+    munmap(mapped, size);
+    return 0;
+}
+
 int main(int argc, char *argv[]) {
     if (signal(SIGINT, ctrlCHandler) == SIG_ERR) {
         perror("smash error: failed to set ctrl-C handler");
     }
+    if (signal(SIGTSTP, ctrlZHandler) == SIG_ERR) {
+        perror("smash error: failed to set ctrl-Z handler");
+    }
+    if (!initChildEventFd()) {
+        perror("smash error: pipe failed");
+    }
+    struct sigaction sigchldAction;
+    memset(&sigchldAction, 0, sizeof(sigchldAction));
+    sigchldAction.sa_handler = sigchldHandler;
+    sigchldAction.sa_flags = SA_RESTART;
+    sigemptyset(&sigchldAction.sa_mask);
+    if (sigaction(SIGCHLD, &sigchldAction, nullptr) == -1) {
+        perror("smash error: failed to set SIGCHLD handler");
+    }
     SmallShell &smash = SmallShell::getInstance();
+    smash.loadRcFile();
+
+    // Batch mode: smash -f <script>
+    if (argc == 3 && strcmp(argv[1], "-f") == 0) {
+        return runScript(smash, argv[2]);
+    } else if (argc != 1) {
+        std::cerr << "usage: smash [-f script]" << std::endl;
+        return 1;
+    }
 
+    bool interactive = isatty(STDIN_FILENO);
     while (true) {
         std::cout << smash.getPrompt() << "> ";
+        if (interactive) {
+            // While the prompt is idle, keep reaping jobs so that queued ones start
+            std::cout.flush();
+            smash.waitForInput(STDIN_FILENO);
+        }
         std::string cmd_line;
         if (!std::getline(std::cin, cmd_line)) {
             // Handle EOF or other input errors
@@ -34,4 +228,3 @@ int main(int argc, char *argv[]) {
 
     return 0;
 }
-